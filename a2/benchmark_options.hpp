@@ -0,0 +1,160 @@
+#ifndef INCLUDE_BENCHMARK_OPTIONS_HPP
+#define INCLUDE_BENCHMARK_OPTIONS_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Command line options every benchmark understands: -sizes, -min-time, -seed and -o.
+// The benchmarks derive their parameters from it and handle their own options in the
+// callback of parse.
+struct BenchmarkOptions
+{
+    explicit BenchmarkOptions(const std::string &defaultSizes)
+        : minSeconds(0.5)
+        , seed(1)
+        , sizesText_(defaultSizes)
+    {
+    }
+
+    // Reads "-name value" pairs, parseOption(name, value) is called for the options that
+    // are not shared by all benchmarks
+    template<typename ParseOption>
+    void parse(int argc, char* argv[], ParseOption parseOption)
+    {
+        if (argc % 2 == 0)
+        {
+            std::cerr << "Missing value for " << argv[argc - 1] << std::endl;
+            argc--;
+        }
+
+        for (int i = 1; i < argc; i += 2)
+        {
+            if (!strcmp(argv[i], "-sizes"))
+            {
+                sizesText_ = argv[i + 1];
+            }
+            else if (!strcmp(argv[i], "-min-time"))
+            {
+                minSeconds = atof(argv[i + 1]);
+            }
+            else if (!strcmp(argv[i], "-seed"))
+            {
+                seed = strtoull(argv[i + 1], nullptr, 10);
+            }
+            else if (!strcmp(argv[i], "-o"))
+            {
+                outputFilename = argv[i + 1];
+            }
+            else
+            {
+                parseOption(argv[i], argv[i + 1]);
+            }
+        }
+
+        for (const std::string &size : split(sizesText_))
+        {
+            int width = 0;
+            int height = 0;
+            const int values = sscanf(size.c_str(), "%dx%d", &width, &height);
+            if (values == 1)
+            {
+                height = width;
+            }
+            if (values < 1 || width <= 0 || height <= 0)
+            {
+                std::cerr << "Size " << size << " has a invalid value." << std::endl;
+                continue;
+            }
+            widths.push_back(width);
+            heights.push_back(height);
+        }
+
+        if (minSeconds <= 0)
+        {
+            std::cerr << "Minimum time has a invalid value." << std::endl;
+            minSeconds = 0.5;
+        }
+    }
+
+    // Opens the output file if one was given, false if it cannot be written
+    bool openOutput(std::ofstream &file) const
+    {
+        if (outputFilename.empty())
+        {
+            return true;
+        }
+
+        file.open(outputFilename.c_str());
+        if (!file)
+        {
+            std::cerr << "Could not open " << outputFilename << " for writing!" << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    static std::vector<std::string> split(const std::string &text)
+    {
+        std::vector<std::string> items;
+        size_t begin = 0;
+        while (begin <= text.size())
+        {
+            size_t end = text.find(',', begin);
+            if (end == std::string::npos)
+            {
+                end = text.size();
+            }
+            if (end > begin)
+            {
+                items.push_back(text.substr(begin, end - begin));
+            }
+            begin = end + 1;
+        }
+        return items;
+    }
+
+    std::vector<int> widths;
+    std::vector<int> heights;
+    double minSeconds;                  // every combination runs at least this long
+    unsigned long long seed;
+    std::string outputFilename;         // standard output if empty
+
+private:
+    std::string sizesText_;
+};
+
+struct Timing
+{
+    uint64_t iterations;
+    double seconds;
+};
+
+// Repeats the operation until minSeconds have passed, after one untimed warm-up run
+template<typename Operation>
+Timing measure(double minSeconds, Operation operation)
+{
+    typedef std::chrono::steady_clock Clock;
+
+    operation();
+
+    Timing timing = { 0, 0.0 };
+    const Clock::time_point start = Clock::now();
+
+    do
+    {
+        operation();
+        ++timing.iterations;
+        timing.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    } while (timing.seconds < minSeconds);
+
+    return timing;
+}
+
+#endif
@@ -0,0 +1,570 @@
+#ifndef INCLUDE_BIT_RASTER_HPP
+#define INCLUDE_BIT_RASTER_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "counter_rng.hpp"
+#include "life_rule.hpp"
+#include "thread_pool.hpp"
+
+// GCC and Clang vector extensions let the same adder network run on plain words,
+// SSE2 and AVX2 registers. Other compilers fall back to the 64 bit word kernel.
+#if defined(__GNUC__)
+#define BIT_RASTER_VECTOR_KERNELS
+#if defined(__x86_64__) || defined(__i386__)
+#define BIT_RASTER_AVX2_KERNEL
+#endif
+#endif
+
+#if defined(__GNUC__)
+#define BIT_RASTER_INLINE inline __attribute__((always_inline))
+#else
+#define BIT_RASTER_INLINE inline
+#endif
+
+// Game of Life raster storing 64 cells per word. Cell x of a row lives in bit x % 64
+// of word x / 64; padding bits behind the last column are always kept zero.
+//
+// For sparse stepping the board is also divided into tiles of TILE_WORDS words by
+// TILE_ROWS rows, remembering which tiles changed during the last generation.
+struct BitRaster {
+    static const int TILE_WORDS = 4;
+    static const int TILE_ROWS = 64;
+
+    BitRaster(int w, int h)
+        : width(w)
+        , height(h)
+        , wordsPerRow((w + 63) / 64)
+        , words(static_cast<size_t>(wordsPerRow) * h, 0)
+        , scratch(static_cast<size_t>(wordsPerRow) * h, 0)
+        , zeroRow(wordsPerRow, 0)
+        , tileColumns((wordsPerRow + TILE_WORDS - 1) / TILE_WORDS)
+        , tileRows((h + TILE_ROWS - 1) / TILE_ROWS)
+        , changedTiles(static_cast<size_t>(tileColumns) * tileRows, 1)
+        , activeTiles(changedTiles.size(), 1)
+        , computedTiles(0)
+        , skippedTiles(0)
+    {
+    }
+
+    bool get(int x, int y) const
+    {
+        return (row(y)[x / 64] >> (x % 64)) & 1;
+    }
+
+    void set(int x, int y, bool alive)
+    {
+        const uint64_t bit = uint64_t(1) << (x % 64);
+        if (alive) {
+            row(y)[x / 64] |= bit;
+        } else {
+            row(y)[x / 64] &= ~bit;
+        }
+    }
+
+    void flip(int x, int y)
+    {
+        row(y)[x / 64] ^= uint64_t(1) << (x % 64);
+        changedTiles[tile(x / 64 / TILE_WORDS, y / TILE_ROWS)] = 1;
+    }
+
+    uint64_t* row(int y) { return &words[static_cast<size_t>(y) * wordsPerRow]; }
+    const uint64_t* row(int y) const { return &words[static_cast<size_t>(y) * wordsPerRow]; }
+
+    size_t tile(int column, int row) const { return static_cast<size_t>(row) * tileColumns + column; }
+
+    // Valid bits of the last word in each row
+    uint64_t lastWordMask() const
+    {
+        const int bits = width % 64;
+        return bits ? (uint64_t(1) << bits) - 1 : ~uint64_t(0);
+    }
+
+    int width;
+    int height;
+    int wordsPerRow;
+    std::vector<uint64_t> words;
+    std::vector<uint64_t> scratch;  // target of the next generation, swapped with words
+    std::vector<uint64_t> zeroRow;  // neighbour row outside of a non-torus board
+
+    int tileColumns;
+    int tileRows;
+    std::vector<unsigned char> changedTiles;  // tiles that differ from the previous generation
+    std::vector<unsigned char> activeTiles;   // tiles recomputed in the current generation
+    uint64_t computedTiles;
+    uint64_t skippedTiles;
+};
+
+// Rule fixed at compile time. Every neighbour count the rule does not care about
+// folds away in lifeKernel, so e.g. Conway's rule compiles to the few operations of
+// a hand-written kernel. Bit n of Born and Survive stands for n living neighbours.
+template<unsigned Born, unsigned Survive>
+struct FixedRule {
+    static bool matches(const LifeRule &rule)
+    {
+        return rule.born == Born && rule.survive == Survive && !rule.isGenerations();
+    }
+
+    BIT_RASTER_INLINE uint64_t born(int n) const { return ((Born >> n) & 1) ? ~uint64_t(0) : 0; }
+    BIT_RASTER_INLINE uint64_t survives(int n) const { return ((Survive >> n) & 1) ? ~uint64_t(0) : 0; }
+};
+
+// Any other rule, looked up from masks of all ones or all zeros per neighbour count
+struct MaskRule {
+    explicit MaskRule(const LifeRule &rule)
+    {
+        for (int n = 0; n <= 8; ++n) {
+            born_[n] = rule.isBorn(n) ? ~uint64_t(0) : 0;
+            survives_[n] = rule.survives(n) ? ~uint64_t(0) : 0;
+        }
+    }
+
+    BIT_RASTER_INLINE uint64_t born(int n) const { return born_[n]; }
+    BIT_RASTER_INLINE uint64_t survives(int n) const { return survives_[n]; }
+
+private:
+    uint64_t born_[9];
+    uint64_t survives_[9];
+};
+
+typedef FixedRule<(1 << 3), (1 << 2) | (1 << 3)> ConwayRule;                                  // B3/S23
+typedef FixedRule<(1 << 3) | (1 << 6), (1 << 2) | (1 << 3)> HighLifeRule;                     // B36/S23
+typedef FixedRule<(1 << 2), 0> SeedsRule;                                                     // B2/S
+typedef FixedRule<(1 << 3) | (1 << 6) | (1 << 7) | (1 << 8),
+                  (1 << 3) | (1 << 4) | (1 << 6) | (1 << 7) | (1 << 8)> DayAndNightRule;      // B3678/S34678
+typedef FixedRule<(1 << 3), 0x1FF> LifeWithoutDeathRule;                                      // B3/S012345678
+
+// out = select ? b : a, for every bit
+template<typename V>
+BIT_RASTER_INLINE void multiplex(const V &select, const V &a, const V &b, V &out)
+{
+    out = a ^ ((a ^ b) & select);
+}
+
+// Counts the eight neighbour masks with a bit-sliced full-adder network and applies
+// the rule to every lane at once (64 cells per word, 256 per AVX2 register).
+// Vectors are passed by reference, since 32 byte values would need AVX in the ABI.
+template<typename Rule, typename V>
+BIT_RASTER_INLINE void lifeKernel(const Rule &rule, const V &nw, const V &n, const V &ne, const V &w, const V &e,
+                                  const V &sw, const V &s, const V &se, const V &center, V &next)
+{
+    const V upperOnes = nw ^ n ^ ne;
+    const V upperTwos = (nw & n) | (ne & (nw ^ n));
+    const V middleOnes = w ^ e;
+    const V middleTwos = w & e;
+    const V lowerOnes = sw ^ s ^ se;
+    const V lowerTwos = (sw & s) | (se & (sw ^ s));
+
+    const V ones = upperOnes ^ middleOnes ^ lowerOnes;
+    const V onesCarry = (upperOnes & middleOnes) | (lowerOnes & (upperOnes ^ middleOnes));
+
+    const V partialTwos = upperTwos ^ middleTwos ^ lowerTwos;
+    const V partialFours = (upperTwos & middleTwos) | (lowerTwos & (upperTwos ^ middleTwos));
+    const V twos = partialTwos ^ onesCarry;
+    const V fours = partialFours ^ (partialTwos & onesCarry);
+
+    // next state of the cell for every neighbour count ...
+    const V zero = center ^ center;
+    V state[9];
+    for (int count = 0; count <= 8; ++count) {
+        state[count] = (zero | rule.born(count)) ^ ((rule.born(count) ^ rule.survives(count)) & center);
+    }
+
+    // ... selected by the bits of the actual count, one multiplexer level per bit
+    V pairs[4], quads[2];
+    for (int i = 0; i < 4; ++i) {
+        multiplex(ones, state[2 * i], state[2 * i + 1], pairs[i]);
+    }
+    for (int i = 0; i < 2; ++i) {
+        multiplex(twos, pairs[2 * i], pairs[2 * i + 1], quads[i]);
+    }
+    multiplex(fours, quads[0], quads[1], next);
+
+    // eight neighbours leave the lower bits zero, so only rules treating 8 and 0
+    // differently need the fourth bit
+    if (rule.born(8) != rule.born(0) || rule.survives(8) != rule.survives(0)) {
+        const V eights = partialFours & partialTwos & onesCarry;
+        multiplex(eights, V(next), state[8], next);
+    }
+}
+
+// Neighbours to the west of each cell, i.e. the row shifted by one column towards higher x
+BIT_RASTER_INLINE uint64_t westNeighbours(const uint64_t* row, int w, int words, int lastBit, bool isTorus)
+{
+    uint64_t carry = 0;
+    if (w > 0) {
+        carry = row[w - 1] >> 63;
+    } else if (isTorus) {
+        carry = (row[words - 1] >> lastBit) & 1;
+    }
+    return (row[w] << 1) | carry;
+}
+
+// Neighbours to the east of each cell, i.e. the row shifted by one column towards lower x
+BIT_RASTER_INLINE uint64_t eastNeighbours(const uint64_t* row, int w, int words, int lastBit, bool isTorus)
+{
+    uint64_t shifted = row[w] >> 1;
+    if (w < words - 1) {
+        shifted |= row[w + 1] << 63;
+    } else if (isTorus) {
+        shifted |= (row[0] & 1) << lastBit;
+    }
+    return shifted;
+}
+
+template<typename Rule>
+inline uint64_t stepWord(const Rule &rule, const uint64_t* up, const uint64_t* cur, const uint64_t* down,
+                         int w, int words, int lastBit, bool isTorus)
+{
+    uint64_t next;
+    lifeKernel<Rule, uint64_t>(rule,
+        westNeighbours(up, w, words, lastBit, isTorus), up[w], eastNeighbours(up, w, words, lastBit, isTorus),
+        westNeighbours(cur, w, words, lastBit, isTorus), eastNeighbours(cur, w, words, lastBit, isTorus),
+        westNeighbours(down, w, words, lastBit, isTorus), down[w], eastNeighbours(down, w, words, lastBit, isTorus),
+        cur[w], next);
+    return next;
+}
+
+#if defined(BIT_RASTER_VECTOR_KERNELS)
+
+typedef uint64_t BitRasterV2 __attribute__((vector_size(16)));
+typedef uint64_t BitRasterV4 __attribute__((vector_size(32)));
+
+template<typename V>
+BIT_RASTER_INLINE void loadWords(V &v, const uint64_t* words)
+{
+    std::memcpy(&v, words, sizeof(V));
+}
+
+// West and east neighbours of a vector of words starting at words
+template<typename V>
+BIT_RASTER_INLINE void loadNeighbours(const uint64_t* words, V &west, V &center, V &east)
+{
+    V left, right;
+    loadWords(left, words - 1);
+    loadWords(center, words);
+    loadWords(right, words + 1);
+    west = (center << 1) | (left >> 63);
+    east = (center >> 1) | (right << 63);
+}
+
+// Interior words never wrap around the board, so their west and east neighbours are
+// built from unaligned loads one word to the left and right. Returns the first word
+// that was not processed.
+template<typename V, typename Rule>
+BIT_RASTER_INLINE int stepInteriorWords(const Rule &rule, const uint64_t* up, const uint64_t* cur, const uint64_t* down,
+                                        uint64_t* out, int begin, int end)
+{
+    const int lanes = sizeof(V) / sizeof(uint64_t);
+    int w = begin;
+
+    for (; w + lanes <= end; w += lanes) {
+        V nw, n, ne, west, center, east, sw, s, se, next;
+        loadNeighbours(up + w, nw, n, ne);
+        loadNeighbours(cur + w, west, center, east);
+        loadNeighbours(down + w, sw, s, se);
+
+        lifeKernel(rule, nw, n, ne, west, east, sw, s, se, center, next);
+
+        std::memcpy(out + w, &next, sizeof(V));
+    }
+
+    return w;
+}
+
+#if defined(BIT_RASTER_AVX2_KERNEL)
+template<typename Rule>
+__attribute__((target("avx2")))
+inline int stepInteriorWordsAvx2(const Rule &rule, const uint64_t* up, const uint64_t* cur, const uint64_t* down,
+                                 uint64_t* out, int begin, int end)
+{
+    return stepInteriorWords<BitRasterV4>(rule, up, cur, down, out, begin, end);
+}
+
+inline bool hasAvx2()
+{
+    static const bool supported = __builtin_cpu_supports("avx2");
+    return supported;
+}
+#endif
+
+#endif
+
+// Computes words [begin, end) of one row of the next generation
+template<typename Rule>
+inline void stepRow(const Rule &rule, const BitRaster &raster, const uint64_t* up, const uint64_t* cur, const uint64_t* down,
+                    uint64_t* out, int begin, int end, bool isTorus)
+{
+    const int words = raster.wordsPerRow;
+    const int lastBit = (raster.width - 1) % 64;
+    const int interiorEnd = std::min(end, words - 1);
+    int w = begin;
+
+    if (w == 0) {
+        out[0] = stepWord(rule, up, cur, down, 0, words, lastBit, isTorus);
+        w = 1;
+    }
+
+    if (w < interiorEnd) {
+#if defined(BIT_RASTER_AVX2_KERNEL)
+        if (hasAvx2()) {
+            w = stepInteriorWordsAvx2(rule, up, cur, down, out, w, interiorEnd);
+        }
+#endif
+#if defined(BIT_RASTER_VECTOR_KERNELS)
+        w = stepInteriorWords<BitRasterV2>(rule, up, cur, down, out, w, interiorEnd);
+#endif
+        for (; w < interiorEnd; ++w) {
+            out[w] = stepWord(rule, up, cur, down, w, words, lastBit, isTorus);
+        }
+    }
+
+    if (end == words) {
+        if (w < words) {
+            out[words - 1] = stepWord(rule, up, cur, down, words - 1, words, lastBit, isTorus);
+        }
+        out[words - 1] &= raster.lastWordMask();
+    }
+}
+
+inline void neighbourRows(const BitRaster &raster, int y, bool isTorus, const uint64_t* &up, const uint64_t* &down)
+{
+    const int height = raster.height;
+
+    up = &raster.zeroRow[0];
+    down = &raster.zeroRow[0];
+
+    if (y > 0) {
+        up = raster.row(y - 1);
+    } else if (isTorus) {
+        up = raster.row(height - 1);
+    }
+    if (y < height - 1) {
+        down = raster.row(y + 1);
+    } else if (isTorus) {
+        down = raster.row(0);
+    }
+}
+
+template<typename Rule>
+inline void simulateRows(const Rule &rule, BitRaster &raster, int begin, int end, bool isTorus)
+{
+    for (int y = begin; y < end; ++y) {
+        const uint64_t* up;
+        const uint64_t* down;
+        neighbourRows(raster, y, isTorus, up, down);
+
+        stepRow(rule, raster, up, raster.row(y), down, &raster.scratch[static_cast<size_t>(y) * raster.wordsPerRow],
+                0, raster.wordsPerRow, isTorus);
+    }
+}
+
+// Recomputes the active tiles of the given tile rows and records which of them changed
+template<typename Rule>
+inline void simulateTileRows(const Rule &rule, BitRaster &raster, int begin, int end, bool isTorus)
+{
+    for (int tileRow = begin; tileRow < end; ++tileRow) {
+        const int yEnd = std::min(raster.height, (tileRow + 1) * BitRaster::TILE_ROWS);
+
+        for (int tileColumn = 0; tileColumn < raster.tileColumns; ++tileColumn) {
+            const size_t tile = raster.tile(tileColumn, tileRow);
+            if (!raster.activeTiles[tile]) {
+                continue;
+            }
+
+            const int wBegin = tileColumn * BitRaster::TILE_WORDS;
+            const int wEnd = std::min(raster.wordsPerRow, wBegin + BitRaster::TILE_WORDS);
+            uint64_t difference = 0;
+
+            for (int y = tileRow * BitRaster::TILE_ROWS; y < yEnd; ++y) {
+                const uint64_t* up;
+                const uint64_t* down;
+                neighbourRows(raster, y, isTorus, up, down);
+
+                const uint64_t* cur = raster.row(y);
+                uint64_t* out = &raster.scratch[static_cast<size_t>(y) * raster.wordsPerRow];
+                stepRow(rule, raster, up, cur, down, out, wBegin, wEnd, isTorus);
+
+                for (int w = wBegin; w < wEnd; ++w) {
+                    difference |= out[w] ^ cur[w];
+                }
+            }
+
+            raster.changedTiles[tile] = difference != 0;
+        }
+    }
+}
+
+// Marks every tile next to a tile that changed during the last generation as active.
+// All other tiles keep their state, and since they did not change last generation
+// either, the scratch buffer (two generations old) already holds that state.
+inline void markActiveTiles(BitRaster &raster, bool isTorus)
+{
+    const int columns = raster.tileColumns;
+    const int rows = raster.tileRows;
+
+    for (int row = 0; row < rows; ++row) {
+        for (int column = 0; column < columns; ++column) {
+            bool active = false;
+
+            for (int dy = -1; dy <= 1 && !active; ++dy) {
+                for (int dx = -1; dx <= 1 && !active; ++dx) {
+                    int r = row + dy;
+                    int c = column + dx;
+                    if (r < 0 || c < 0 || r >= rows || c >= columns) {
+                        if (!isTorus) {
+                            continue;
+                        }
+                        r = (r + rows) % rows;
+                        c = (c + columns) % columns;
+                    }
+                    active = raster.changedTiles[raster.tile(c, r)] != 0;
+                }
+            }
+
+            raster.activeTiles[raster.tile(column, row)] = active;
+            if (active) {
+                ++raster.computedTiles;
+            } else {
+                ++raster.skippedTiles;
+            }
+        }
+    }
+}
+
+// Calls step(rule) with the compile-time specialization of the rule if there is one,
+// so the kernel is chosen once per generation rather than per word
+template<typename Step>
+inline void dispatchRule(const LifeRule &rule, const Step &step)
+{
+    if (ConwayRule::matches(rule)) {
+        step(ConwayRule());
+    } else if (HighLifeRule::matches(rule)) {
+        step(HighLifeRule());
+    } else if (SeedsRule::matches(rule)) {
+        step(SeedsRule());
+    } else if (DayAndNightRule::matches(rule)) {
+        step(DayAndNightRule());
+    } else if (LifeWithoutDeathRule::matches(rule)) {
+        step(LifeWithoutDeathRule());
+    } else {
+        step(MaskRule(rule));
+    }
+}
+
+// Bands only read the previous generation and write disjoint rows of the next one,
+// so the rows bordering other bands (and the torus seam) need no extra copies.
+struct StepAllRows {
+    BitRaster &raster;
+    bool isTorus;
+    ThreadPool* pool;
+
+    template<typename Rule>
+    void operator()(const Rule &rule) const
+    {
+        BitRaster &raster = this->raster;
+        const bool isTorus = this->isTorus;
+
+        if (pool) {
+            const int band = pool->bandHeight(raster.height, raster.wordsPerRow * sizeof(uint64_t));
+            pool->parallelFor(raster.height, band, [&](int begin, int end) {
+                simulateRows(rule, raster, begin, end, isTorus);
+            });
+        } else {
+            simulateRows(rule, raster, 0, raster.height, isTorus);
+        }
+    }
+};
+
+struct StepActiveTiles {
+    BitRaster &raster;
+    bool isTorus;
+    ThreadPool* pool;
+
+    template<typename Rule>
+    void operator()(const Rule &rule) const
+    {
+        BitRaster &raster = this->raster;
+        const bool isTorus = this->isTorus;
+
+        if (pool) {
+            pool->parallelFor(raster.tileRows, 1, [&](int begin, int end) {
+                simulateTileRows(rule, raster, begin, end, isTorus);
+            });
+        } else {
+            simulateTileRows(rule, raster, 0, raster.tileRows, isTorus);
+        }
+    }
+};
+
+// Life-like rules only, Generations rules need more than one bit per cell
+inline void simulateNextState(BitRaster &raster, bool isTorus, const LifeRule &rule, ThreadPool* pool = nullptr)
+{
+    const StepAllRows step = { raster, isTorus, pool };
+    dispatchRule(rule, step);
+
+    // without tracking every tile may have changed
+    std::fill(raster.changedTiles.begin(), raster.changedTiles.end(), 1);
+    raster.words.swap(raster.scratch);
+}
+
+// Like simulateNextState, but only recomputes tiles whose neighbourhood changed
+inline void simulateNextStateSparse(BitRaster &raster, bool isTorus, const LifeRule &rule, ThreadPool* pool = nullptr)
+{
+    markActiveTiles(raster, isTorus);
+
+    const StepActiveTiles step = { raster, isTorus, pool };
+    dispatchRule(rule, step);
+
+    raster.words.swap(raster.scratch);
+}
+
+inline void invadeTileRows(BitRaster &raster, const RandomMask &mask, const CounterRng &rng, uint32_t generation,
+                           int begin, int end)
+{
+    for (int tileRow = begin; tileRow < end; ++tileRow) {
+        const int yEnd = std::min(raster.height, (tileRow + 1) * BitRaster::TILE_ROWS);
+
+        for (int y = tileRow * BitRaster::TILE_ROWS; y < yEnd; ++y) {
+            uint64_t* row = raster.row(y);
+
+            for (int w = 0; w < raster.wordsPerRow; ++w) {
+                uint64_t flips = mask.draw(rng, CounterRng::INVASION, generation, y, w);
+                if (w == raster.wordsPerRow - 1) {
+                    flips &= raster.lastWordMask();
+                }
+                if (flips) {
+                    row[w] ^= flips;
+                    raster.changedTiles[raster.tile(w / BitRaster::TILE_WORDS, tileRow)] = 1;
+                }
+            }
+        }
+    }
+}
+
+// Flips every cell with the probability invasionFactor, 64 cells per random mask.
+// Tile rows are handed out whole, so no two threads mark the same tile.
+inline void simulateInvasion(BitRaster &raster, float invasionFactor, const CounterRng &rng, uint32_t generation,
+                             ThreadPool* pool = nullptr)
+{
+    const RandomMask mask(invasionFactor);
+
+    if (mask.isEmpty())
+    {
+        return;
+    }
+
+    if (pool) {
+        pool->parallelFor(raster.tileRows, 1, [&](int begin, int end) {
+            invadeTileRows(raster, mask, rng, generation, begin, end);
+        });
+    } else {
+        invadeTileRows(raster, mask, rng, generation, 0, raster.tileRows);
+    }
+}
+
+#endif
@@ -7,7 +7,8 @@
 * Author: Arash Partow - 2002                                             *
 * URL: http://partow.net/programming/bitmap/index.html                    *
 *                                                                         *
-* Note: This library only supports 24-bits per pixel bitmap format files. *
+* Note: This library supports 24-bits per pixel bitmap format files and   *
+* reads and writes 1 and 8-bits per pixel palettized files.               *
 *                                                                         *
 * Copyright notice:                                                       *
 * Free use of the Platform Independent Bitmap Image Reader Writer Library *
@@ -24,13 +25,43 @@
 
 #include <algorithm>
 #include <cmath>
+#include <cstdint>
 #include <cstdlib>
+#include <cstring>
 #include <fstream>
 #include <iostream>
 #include <iterator>
 #include <limits>
 #include <string>
+#include <thread>
+#include <vector>
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#include <emmintrin.h>
+#define BITMAP_IMAGE_SSE2
+#endif
+
+/* AVX2 kernels are compiled for x86 GCC and Clang and picked at run time */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define BITMAP_IMAGE_AVX2
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define BITMAP_IMAGE_MMAP
+#endif
+
+
+struct rgb_store
+{
+   unsigned char red;
+   unsigned char green;
+   unsigned char blue;
+};
 
 class bitmap_image
 {
@@ -47,6 +78,18 @@ public:
                        red_plane   = 2
                     };
 
+   enum execution_policy {
+                            sequential_execution          = 0,
+                            vectorized_execution          = 1,
+                            parallel_execution            = 2,
+                            parallel_vectorized_execution = 3
+                         };
+
+   enum mapping_mode {
+                        read_only_mapping     = 0,
+                        copy_on_write_mapping = 1
+                     };
+
 
    bitmap_image()
    : file_name_(""),
@@ -56,7 +99,9 @@ public:
      height_(0),
      row_increment_(0),
      bytes_per_pixel_(3),
-     channel_mode_(bgr_mode)
+     channel_mode_(bgr_mode),
+     mapping_(0),
+     mapping_length_(0)
    {}
 
    bitmap_image(const std::string& filename)
@@ -67,11 +112,38 @@ public:
      height_(0),
      row_increment_(0),
      bytes_per_pixel_(0),
-     channel_mode_(bgr_mode)
+     channel_mode_(bgr_mode),
+     mapping_(0),
+     mapping_length_(0)
    {
       load_bitmap();
    }
 
+   /*
+      Maps the file into memory instead of reading it. Top-down 24-bit
+      files whose rows need no padding (width a multiple of 4) are used
+      in place: data_ points into the mapping, so loading touches only
+      the pages that are accessed later. With read_only_mapping such an
+      image must not be written to, with copy_on_write_mapping writes
+      go to private pages and never reach the file. All other files are
+      copied out of the mapping once, which still saves the buffered
+      stream reads of load_bitmap.
+   */
+   bitmap_image(const std::string& filename, const mapping_mode mode)
+   : file_name_(filename),
+     data_  (0),
+     length_(0),
+     width_ (0),
+     height_(0),
+     row_increment_(0),
+     bytes_per_pixel_(0),
+     channel_mode_(bgr_mode),
+     mapping_(0),
+     mapping_length_(0)
+   {
+      map_bitmap(mode);
+   }
+
    bitmap_image(const unsigned int width, const unsigned int height)
    : file_name_(""),
      data_  (0),
@@ -80,7 +152,9 @@ public:
      height_(height),
      row_increment_(0),
      bytes_per_pixel_(3),
-     channel_mode_(bgr_mode)
+     channel_mode_(bgr_mode),
+     mapping_(0),
+     mapping_length_(0)
    {
      create_bitmap();
    }
@@ -92,7 +166,9 @@ public:
      height_(image.height_),
      row_increment_(0),
      bytes_per_pixel_(3),
-     channel_mode_(bgr_mode)
+     channel_mode_(bgr_mode),
+     mapping_(0),
+     mapping_length_(0)
    {
       create_bitmap();
       std::copy(image.data_, image.data_ + image.length_, data_);
@@ -100,7 +176,7 @@ public:
 
   ~bitmap_image()
    {
-      delete [] data_;
+      release_data();
    }
 
    bitmap_image& operator=(const bitmap_image& image)
@@ -120,6 +196,11 @@ public:
       return *this;
    }
 
+   inline bool is_mapped() const
+   {
+      return (0 != mapping_);
+   }
+
    inline bool operator!()
    {
       return (data_         == 0) ||
@@ -174,7 +255,7 @@ public:
                          unsigned char& green,
                          unsigned char& blue)
    {
-      const unsigned int y_offset = y * row_increment_;
+      const std::size_t y_offset = y * row_increment_;
       const unsigned int x_offset = x * bytes_per_pixel_;
       blue  = data_[y_offset + x_offset + 0];
       green = data_[y_offset + x_offset + 1];
@@ -186,7 +267,7 @@ public:
                          const unsigned char green,
                          const unsigned char blue)
    {
-      const unsigned int y_offset = y * row_increment_;
+      const std::size_t y_offset = y * row_increment_;
       const unsigned int x_offset = x * bytes_per_pixel_;
       data_[y_offset + x_offset + 0] = blue;
       data_[y_offset + x_offset + 1] = green;
@@ -363,8 +444,7 @@ public:
                                const unsigned int height,
                                const bool clear = false)
    {
-      delete[] data_;
-      data_   = 0;
+      release_data();
       width_  = width;
       height_ = height;
 
@@ -399,10 +479,10 @@ public:
       bih.size             = 40;
       bih.x_pels_per_meter =  0;
       bih.y_pels_per_meter =  0;
-      bih.size_image       = (((bih.width * bytes_per_pixel_) + 3) & 0x0000FFFC) * bih.height;
+      bih.size_image       = (((bih.width * bytes_per_pixel_) + 3) & ~3u) * bih.height;
 
       bfh.type      = 19778;
-      bfh.size      = 55 + bih.size_image;
+      bfh.size      = 54 + bih.size_image;
       bfh.reserved1 = 0;
       bfh.reserved2 = 0;
       bfh.off_bits  = bih.struct_size() + bfh.struct_size();
@@ -423,6 +503,191 @@ public:
       stream.close();
    }
 
+   /*
+      Writes the same file as save_image, but sizes the file up front and
+      copies the rows straight into a shared mapping of it, so the data
+      passes through no stream buffer. Falls back to a stream where
+      memory mapped files are not available.
+   */
+   void save_image_mapped(const std::string& file_name)
+   {
+      const std::size_t row_length = static_cast<std::size_t>(bytes_per_pixel_) * width_;
+
+      const auto copy_row = [&](const unsigned int row_index, unsigned char* file_row)
+                            {
+                               std::memcpy(file_row,row(row_index),row_length);
+                            };
+
+      if (!save_rows_mapped(file_name,width_,height_,copy_row))
+      {
+         std::cout << "bitmap_image::save_image_mapped(): Error - Could not write file "  << file_name << "!" << std::endl;
+      }
+   }
+
+   /*
+      Writes a 24 bit bitmap straight from a bit mask laid out as for
+      import_bit_mask, one row at a time into a mapping of the file,
+      without the intermediate 24 bit image. Set bits get set_color,
+      the others unset_color.
+   */
+   static bool save_bit_mask_rgb(const std::string& file_name,
+                                 const unsigned int width,
+                                 const unsigned int height,
+                                 const uint64_t* bits,
+                                 const std::size_t words_per_row,
+                                 const rgb_store& set_color,
+                                 const rgb_store& unset_color)
+   {
+      const mask_pattern pattern = make_mask_pattern(set_color,unset_color,bgr_mode);
+
+      const auto expand_row = [&](const unsigned int row_index, unsigned char* file_row)
+                              {
+                                 expand_bit_mask_row(bits + words_per_row * row_index,width,pattern,file_row);
+                              };
+
+      if (!save_rows_mapped(file_name,width,height,expand_row))
+      {
+         std::cout << "bitmap_image::save_bit_mask_rgb(): Error - Could not write file "  << file_name << "!" << std::endl;
+         return false;
+      }
+
+      return true;
+   }
+
+   /*
+      Writes a one bit per pixel bitmap straight from a bit mask laid
+      out as for import_bit_mask, without expanding it to 24 bits
+      first. Set bits get set_color, the others unset_color.
+   */
+   static void write_bit_mask(std::ofstream& stream,
+                              const unsigned int width,
+                              const unsigned int height,
+                              const uint64_t* bits,
+                              const std::size_t words_per_row,
+                              const rgb_store& set_color,
+                              const rgb_store& unset_color)
+   {
+      static const reversed_bits reversed;
+
+      write_indexed_header(stream,width,height,1,2);
+      write_palette_entry(stream,unset_color);
+      write_palette_entry(stream,set_color);
+
+      const std::size_t row_bytes = (width + 7) / 8;
+      std::vector<unsigned char> file_row(((static_cast<std::size_t>(width) + 31) / 32) * 4,0);
+
+      /* bits past the width are left 0 */
+      const unsigned char last_mask = static_cast<unsigned char>(0xFF << ((8 - (width % 8)) % 8));
+
+      for (unsigned int i = 0; i < height; ++i)
+      {
+         const uint64_t* row_bits = bits + words_per_row * (height - i - 1);
+
+         for (std::size_t b = 0; b < row_bytes; ++b)
+         {
+            file_row[b] = reversed.table[(row_bits[b / 8] >> (8 * (b % 8))) & 0xFF];
+         }
+
+         if (row_bytes)
+         {
+            file_row[row_bytes - 1] &= last_mask;
+         }
+
+         stream.write(reinterpret_cast<const char*>(&file_row[0]),file_row.size());
+      }
+   }
+
+   static bool save_bit_mask(const std::string& file_name,
+                             const unsigned int width,
+                             const unsigned int height,
+                             const uint64_t* bits,
+                             const std::size_t words_per_row,
+                             const rgb_store& set_color,
+                             const rgb_store& unset_color)
+   {
+      std::ofstream stream(file_name.c_str(),std::ios::binary);
+
+      if (!stream)
+      {
+         std::cout << "bitmap_image::save_bit_mask(): Error - Could not open file "  << file_name << " for writing!" << std::endl;
+         return false;
+      }
+
+      write_bit_mask(stream,width,height,bits,words_per_row,set_color,unset_color);
+
+      return !!stream;
+   }
+
+   /*
+      Saves with the smallest pixel format that holds all colors of the
+      image: one bit per pixel for up to two colors, eight bits with a
+      palette for up to 256 and 24 bits otherwise.
+   */
+   void save_image_indexed(const std::string& file_name)
+   {
+      std::vector<uint32_t> colors;
+
+      if (!collect_palette(colors))
+      {
+         save_image(file_name);
+         return;
+      }
+
+      std::ofstream stream(file_name.c_str(),std::ios::binary);
+
+      if (!stream)
+      {
+         std::cout << "bitmap_image::save_image_indexed(): Error - Could not open file "  << file_name << " for writing!" << std::endl;
+         return;
+      }
+
+      const unsigned short bits = (colors.size() <= 2) ? 1 : 8;
+
+      write_indexed_header(stream,width_,height_,bits,static_cast<unsigned int>(colors.size()));
+
+      for (std::size_t i = 0; i < colors.size(); ++i)
+      {
+         const unsigned char entry[4] = {
+                                           static_cast<unsigned char>(colors[i]      ),
+                                           static_cast<unsigned char>(colors[i] >>  8),
+                                           static_cast<unsigned char>(colors[i] >> 16),
+                                           0x00
+                                        };
+         stream.write(reinterpret_cast<const char*>(entry),4);
+      }
+
+      std::vector<unsigned char> file_row(((static_cast<std::size_t>(width_) * bits + 31) / 32) * 4,0);
+
+      uint32_t     last_color = color_key(data_);
+      unsigned int last_index = palette_index(colors,last_color);
+
+      for (unsigned int i = 0; i < height_; ++i)
+      {
+         const unsigned char* itr = row(height_ - i - 1);
+
+         std::fill(file_row.begin(),file_row.end(),0x00);
+
+         for (unsigned int x = 0; x < width_; ++x, itr += bytes_per_pixel_)
+         {
+            const uint32_t color = color_key(itr);
+
+            /* images are mostly runs of one color */
+            if (color != last_color)
+            {
+               last_color = color;
+               last_index = palette_index(colors,color);
+            }
+
+            if (1 == bits)
+               file_row[x / 8] |= static_cast<unsigned char>(last_index << (7 - (x % 8)));
+            else
+               file_row[x] = static_cast<unsigned char>(last_index);
+         }
+
+         stream.write(reinterpret_cast<const char*>(&file_row[0]),file_row.size());
+      }
+   }
+
    inline void set_all_ith_bits_low(const unsigned int bitr_index)
    {
       unsigned char mask = static_cast<unsigned char>(~(1 << bitr_index));
@@ -846,6 +1111,144 @@ public:
       }
    }
 
+   /*
+      Bulk conversion between pixels and masks, e.g. the cells of a
+      simulation. A byte mask holds one byte per pixel (non-zero is set),
+      a bit mask one bit per pixel, pixel x of a row in bit (x % 64) of
+      word (x / 64). Set pixels are written in set_color, all others in
+      unset_color. Exporting sets every pixel whose three channels are
+      all below the threshold, i.e. threshold 1 only selects black.
+   */
+   inline void import_mask_row(const unsigned int row_index,
+                               const unsigned char* mask,
+                               const rgb_store& set_color,
+                               const rgb_store& unset_color)
+   {
+      const mask_pattern pattern = make_mask_pattern(set_color,unset_color);
+      unsigned char* itr = row(row_index);
+      unsigned int x = 0;
+
+      #if defined(BITMAP_IMAGE_SSE2)
+      const __m128i zero = _mm_setzero_si128();
+
+      for (; (x + 16) <= width_; x += 16, itr += 48)
+      {
+         const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(mask + x));
+         const unsigned int bits = ~static_cast<unsigned int>(_mm_movemask_epi8(_mm_cmpeq_epi8(bytes,zero)));
+
+         write_mask_block(bits & 0xFF,pattern,itr);
+         write_mask_block((bits >> 8) & 0xFF,pattern,itr + 24);
+      }
+      #endif
+
+      for (; (x + 8) <= width_; x += 8, itr += 24)
+      {
+         unsigned int bits = 0;
+
+         for (unsigned int i = 0; i < 8; ++i)
+         {
+            bits |= (0 != mask[x + i]) ? (1U << i) : 0U;
+         }
+
+         write_mask_block(bits,pattern,itr);
+      }
+
+      for (; x < width_; ++x, itr += 3)
+      {
+         std::memcpy(itr,(0 != mask[x]) ? pattern.set : pattern.unset,3);
+      }
+   }
+
+   inline void import_bit_mask_row(const unsigned int row_index,
+                                   const uint64_t* bits,
+                                   const rgb_store& set_color,
+                                   const rgb_store& unset_color)
+   {
+      expand_bit_mask_row(bits,width_,make_mask_pattern(set_color,unset_color),row(row_index));
+   }
+
+   inline void export_mask_row(const unsigned int row_index,
+                               unsigned char* mask,
+                               const unsigned char threshold = 128) const
+   {
+      const unsigned char* itr = row(row_index);
+      unsigned int x = 0;
+
+      #if defined(BITMAP_IMAGE_SSE2)
+      for (; (x + 16) <= width_; x += 16, itr += 48)
+      {
+         static const bit_bytes bytes;
+         const unsigned int bits = threshold_block(itr,threshold);
+
+         std::memcpy(mask + x    ,&bytes.table[bits & 0xFF],8);
+         std::memcpy(mask + x + 8,&bytes.table[bits >> 8  ],8);
+      }
+      #endif
+
+      for (; x < width_; ++x, itr += 3)
+      {
+         mask[x] = ((itr[0] < threshold) && (itr[1] < threshold) && (itr[2] < threshold)) ? 1 : 0;
+      }
+   }
+
+   inline void export_bit_mask_row(const unsigned int row_index,
+                                   uint64_t* bits,
+                                   const unsigned char threshold = 128) const
+   {
+      const unsigned char* itr = row(row_index);
+      std::fill(bits,bits + (width_ + 63) / 64,0);
+      unsigned int x = 0;
+
+      #if defined(BITMAP_IMAGE_SSE2)
+      for (; (x + 16) <= width_; x += 16, itr += 48)
+      {
+         bits[x / 64] |= static_cast<uint64_t>(threshold_block(itr,threshold)) << (x % 64);
+      }
+      #endif
+
+      for (; x < width_; ++x, itr += 3)
+      {
+         if ((itr[0] < threshold) && (itr[1] < threshold) && (itr[2] < threshold))
+         {
+            bits[x / 64] |= static_cast<uint64_t>(1) << (x % 64);
+         }
+      }
+   }
+
+   // Whole image versions, mask rows are width() bytes or words_per_row words apart.
+   inline void import_mask(const unsigned char* mask, const rgb_store& set_color, const rgb_store& unset_color)
+   {
+      for (unsigned int y = 0; y < height_; ++y)
+      {
+         import_mask_row(y,mask + static_cast<std::size_t>(y) * width_,set_color,unset_color);
+      }
+   }
+
+   inline void import_bit_mask(const uint64_t* bits, const std::size_t words_per_row,
+                               const rgb_store& set_color, const rgb_store& unset_color)
+   {
+      for (unsigned int y = 0; y < height_; ++y)
+      {
+         import_bit_mask_row(y,bits + y * words_per_row,set_color,unset_color);
+      }
+   }
+
+   inline void export_mask(unsigned char* mask, const unsigned char threshold = 128) const
+   {
+      for (unsigned int y = 0; y < height_; ++y)
+      {
+         export_mask_row(y,mask + static_cast<std::size_t>(y) * width_,threshold);
+      }
+   }
+
+   inline void export_bit_mask(uint64_t* bits, const std::size_t words_per_row, const unsigned char threshold = 128) const
+   {
+      for (unsigned int y = 0; y < height_; ++y)
+      {
+         export_bit_mask_row(y,bits + y * words_per_row,threshold);
+      }
+   }
+
    inline void subsample(bitmap_image& dest)
    {
       /*
@@ -891,9 +1294,12 @@ public:
       itr1[1] = data_ + 1;
       itr1[2] = data_ + 2;
 
-      itr2[0] = data_ + row_increment_ + 0;
-      itr2[1] = data_ + row_increment_ + 1;
-      itr2[2] = data_ + row_increment_ + 2;
+      /* a single row is averaged with itself */
+      const std::size_t second_row = (height_ > 1) ? row_increment_ : 0;
+
+      itr2[0] = data_ + second_row + 0;
+      itr2[1] = data_ + second_row + 1;
+      itr2[2] = data_ + second_row + 2;
 
       unsigned int total = 0;
 
@@ -1130,71 +1536,329 @@ public:
       }
    }
 
-   inline unsigned int offset(const color_plane color)
+   /*
+      Policy variants of the operations above, giving exactly the same
+      results. vectorized_execution uses SSE2 where the bytes of a row
+      can be processed independently (grayscale, alpha blend, psnr) and
+      otherwise row kernels that touch each byte once. parallel_execution
+      splits the rows into one contiguous range per hardware thread, as
+      long as every thread gets enough work to pay for starting it.
+   */
+   inline void convert_to_grayscale(const execution_policy policy)
    {
-      switch (channel_mode_)
+      if (sequential_execution == policy)
       {
-         case rgb_mode : {
-                            switch (color)
-                            {
-                               case red_plane   : return 0;
-                               case green_plane : return 1;
-                               case blue_plane  : return 2;
-                               default          : return std::numeric_limits<unsigned int>::max();
-                            }
-                         }
+         convert_to_grayscale();
+         return;
+      }
 
-         case bgr_mode : {
-                            switch (color)
-                            {
-                               case red_plane   : return 2;
-                               case green_plane : return 1;
-                               case blue_plane  : return 0;
-                               default          : return std::numeric_limits<unsigned int>::max();
-                            }
-                         }
+      double r_scaler = 0.299;
+      double g_scaler = 0.587;
+      double b_scaler = 0.114;
 
-         default       : return std::numeric_limits<unsigned int>::max();
+      if (rgb_mode == channel_mode_)
+      {
+         std::swap(r_scaler,b_scaler);
       }
-   }
 
-   inline void incremental()
-   {
-      unsigned char current_color = 0;
+      /* the products of the scalar loop, so the sums round identically */
+      grayscale_table table;
 
-      for (unsigned char* itr = data_; itr < (data_ + length_);)
+      for (unsigned int v = 0; v < 256; ++v)
       {
-         (*itr++) = (current_color);
-         (*itr++) = (current_color);
-         (*itr++) = (current_color);
+         table.weighted[0][v] = b_scaler * v;
+         table.weighted[1][v] = g_scaler * v;
+         table.weighted[2][v] = r_scaler * v;
+      }
 
-         ++current_color;
+      const bool vectorized = (0 != (policy & vectorized_execution));
+
+      for_each_row_range(worker_count(policy,row_increment_),height_,
+                         [&](const unsigned int, const unsigned int begin, const unsigned int end)
+                         {
+                            grayscale_rows(table,begin,end,vectorized);
+                         });
+   }
+
+   inline void subsample(bitmap_image& dest, const execution_policy policy)
+   {
+      if (sequential_execution == policy)
+      {
+         subsample(dest);
+         return;
       }
+
+      const unsigned int w = (width_  + 1) / 2;
+      const unsigned int h = (height_ + 1) / 2;
+
+      dest.setwidth_height(w,h);
+
+      for_each_row_range(worker_count(policy,2 * row_increment_),h,
+                         [&](const unsigned int, const unsigned int begin, const unsigned int end)
+                         {
+                            subsample_rows(dest,begin,end);
+                         });
    }
 
-private:
+   inline void upsample(bitmap_image& dest, const execution_policy policy)
+   {
+      if (sequential_execution == policy)
+      {
+         upsample(dest);
+         return;
+      }
 
-   struct bitmap_file_header
+      dest.setwidth_height(2 * width_ ,2 * height_);
+
+      for_each_row_range(worker_count(policy,5 * row_increment_),height_,
+                         [&](const unsigned int, const unsigned int begin, const unsigned int end)
+                         {
+                            upsample_rows(dest,begin,end);
+                         });
+   }
+
+   inline void alpha_blend(const double& alpha, const bitmap_image& image, const execution_policy policy)
    {
-      unsigned short type;
-      unsigned int   size;
-      unsigned short reserved1;
-      unsigned short reserved2;
-      unsigned int   off_bits;
+      if (sequential_execution == policy)
+      {
+         alpha_blend(alpha,image);
+         return;
+      }
 
-      unsigned int struct_size()
+      if (
+           (image.width_  != width_ ) ||
+           (image.height_ != height_)
+         )
       {
-         return sizeof(type)      +
-                sizeof(size)      +
-                sizeof(reserved1) +
-                sizeof(reserved2) +
-                sizeof(off_bits);
+         return;
       }
-   };
 
-   struct bitmap_information_header
-   {
-      unsigned int   size;
+      if ((alpha < 0.0) || (alpha > 1.0))
+      {
+         return;
+      }
+
+      const bool vectorized = (0 != (policy & vectorized_execution));
+
+      for_each_row_range(worker_count(policy,2 * row_increment_),height_,
+                         [&](const unsigned int, const unsigned int begin, const unsigned int end)
+                         {
+                            alpha_blend_rows(alpha,image,begin,end,vectorized);
+                         });
+   }
+
+   inline double psnr(const bitmap_image& image, const execution_policy policy)
+   {
+      if (sequential_execution == policy)
+      {
+         return psnr(image);
+      }
+
+      if (
+           (image.width_  != width_ ) ||
+           (image.height_ != height_)
+         )
+      {
+         return 0.0;
+      }
+
+      const bool vectorized = (0 != (policy & vectorized_execution));
+      const unsigned int workers = worker_count(policy,2 * row_increment_);
+
+      std::vector<uint64_t> sums(workers,0);
+
+      for_each_row_range(workers,height_,
+                         [&](const unsigned int worker, const unsigned int begin, const unsigned int end)
+                         {
+                            sums[worker] = squared_error_rows(image,begin,end,vectorized);
+                         });
+
+      /* exact integer sum, the scalar version reaches the same double */
+      double mse = 0.0;
+
+      for (unsigned int i = 0; i < workers; ++i)
+      {
+         mse += static_cast<double>(sums[i]);
+      }
+
+      if (mse <= 0.0000001)
+      {
+         return 1000000.0;
+      }
+      else
+      {
+         mse /= (3.0 * width_ * height_);
+         return 20.0 * std::log10(255.0 / std::sqrt(mse));
+      }
+   }
+
+   inline void histogram(const color_plane color, double hist[256], const execution_policy policy)
+   {
+      if (sequential_execution == policy)
+      {
+         histogram(color,hist);
+         return;
+      }
+
+      const unsigned int channel = offset(color);
+      const bool vectorized = (0 != (policy & vectorized_execution));
+      const unsigned int workers = worker_count(policy,row_increment_);
+
+      std::vector<unsigned int> counts(256 * workers,0);
+
+      for_each_row_range(workers,height_,
+                         [&](const unsigned int worker, const unsigned int begin, const unsigned int end)
+                         {
+                            histogram_rows(channel,&counts[256 * worker],begin,end,vectorized);
+                         });
+
+      std::fill(hist,hist + 256,0.0);
+
+      for (unsigned int i = 0; i < counts.size(); ++i)
+      {
+         hist[i & 0xFF] += counts[i];
+      }
+   }
+
+   /*
+      False color rendering of a scalar field holding one value per pixel
+      in row-major order, e.g. cell ages. Values from lower to upper are
+      spread evenly over the colormap_size entries of colormap, values
+      outside the range and NaN are clamped to the first or last entry.
+      With vectorized_execution eight pixels share one AVX2 gather where
+      the processor supports it.
+   */
+   inline void apply_colormap(const float* field,
+                              const float lower,
+                              const float upper,
+                              const rgb_store colormap[],
+                              const unsigned int colormap_size = 1000,
+                              const execution_policy policy = parallel_vectorized_execution)
+   {
+      if ((0 == colormap_size) || !(upper > lower))
+      {
+         return;
+      }
+
+      std::vector<uint32_t> colors(colormap_size);
+
+      for (unsigned int i = 0; i < colormap_size; ++i)
+      {
+         colors[i] = pack_color(colormap[i]);
+      }
+
+      const float scale = colormap_size / (upper - lower);
+      const bool vectorized = (0 != (policy & vectorized_execution));
+
+      for_each_row_range(worker_count(policy,row_increment_ + 4 * width_),height_,
+                         [&](const unsigned int, const unsigned int begin, const unsigned int end)
+                         {
+                            colormap_rows(field,lower,scale,colors,begin,end,vectorized);
+                         });
+   }
+
+   /*
+      The same for integer fields. Each value from lower to upper gets a
+      colormap entry of its own up front, so a pixel only costs a clamp
+      and a table lookup.
+   */
+   inline void apply_colormap(const uint16_t* field,
+                              const uint16_t lower,
+                              const uint16_t upper,
+                              const rgb_store colormap[],
+                              const unsigned int colormap_size = 1000,
+                              const execution_policy policy = parallel_vectorized_execution)
+   {
+      if ((0 == colormap_size) || (upper < lower))
+      {
+         return;
+      }
+
+      const unsigned int values = upper - lower + 1u;
+      std::vector<uint32_t> colors(values);
+
+      for (unsigned int v = 0; v < values; ++v)
+      {
+         colors[v] = pack_color(colormap[(static_cast<uint64_t>(v) * colormap_size) / values]);
+      }
+
+      const bool vectorized = (0 != (policy & vectorized_execution));
+
+      for_each_row_range(worker_count(policy,row_increment_ + 2 * width_),height_,
+                         [&](const unsigned int, const unsigned int begin, const unsigned int end)
+                         {
+                            colormap_rows(field,lower,upper,colors,begin,end,vectorized);
+                         });
+   }
+
+   inline unsigned int offset(const color_plane color)
+   {
+      switch (channel_mode_)
+      {
+         case rgb_mode : {
+                            switch (color)
+                            {
+                               case red_plane   : return 0;
+                               case green_plane : return 1;
+                               case blue_plane  : return 2;
+                               default          : return std::numeric_limits<unsigned int>::max();
+                            }
+                         }
+
+         case bgr_mode : {
+                            switch (color)
+                            {
+                               case red_plane   : return 2;
+                               case green_plane : return 1;
+                               case blue_plane  : return 0;
+                               default          : return std::numeric_limits<unsigned int>::max();
+                            }
+                         }
+
+         default       : return std::numeric_limits<unsigned int>::max();
+      }
+   }
+
+   inline void incremental()
+   {
+      unsigned char current_color = 0;
+
+      for (unsigned char* itr = data_; itr < (data_ + length_);)
+      {
+         (*itr++) = (current_color);
+         (*itr++) = (current_color);
+         (*itr++) = (current_color);
+
+         ++current_color;
+      }
+   }
+
+private:
+
+   friend class bitmap_strip_reader;
+   friend class bitmap_strip_writer;
+
+   struct bitmap_file_header
+   {
+      unsigned short type;
+      unsigned int   size;
+      unsigned short reserved1;
+      unsigned short reserved2;
+      unsigned int   off_bits;
+
+      unsigned int struct_size() const
+      {
+         return sizeof(type)      +
+                sizeof(size)      +
+                sizeof(reserved1) +
+                sizeof(reserved2) +
+                sizeof(off_bits);
+      }
+   };
+
+   struct bitmap_information_header
+   {
+      unsigned int   size;
       unsigned int   width;
       unsigned int   height;
       unsigned short planes;
@@ -1206,7 +1870,7 @@ private:
       unsigned int   clr_used;
       unsigned int   clr_important;
 
-      unsigned int struct_size()
+      unsigned int struct_size() const
       {
          return sizeof(size)             +
                 sizeof(width)            +
@@ -1222,19 +1886,19 @@ private:
       }
    };
 
-   inline bool big_endian()
+   static inline bool big_endian()
    {
       unsigned int v = 0x01;
 
       return (1 != reinterpret_cast<char*>(&v)[0]);
    }
 
-   inline unsigned short flip(const unsigned short& v)
+   static inline unsigned short flip(const unsigned short& v)
    {
       return ((v >> 8) | (v << 8));
    }
 
-   inline unsigned int flip(const unsigned int& v)
+   static inline unsigned int flip(const unsigned int& v)
    {
       return (((v & 0xFF000000) >> 0x18) |
               ((v & 0x000000FF) << 0x18) |
@@ -1243,18 +1907,34 @@ private:
    }
 
    template<typename T>
-   inline void read_from_stream(std::ifstream& stream,T& t)
+   static inline void read_from_stream(std::ifstream& stream,T& t)
    {
       stream.read(reinterpret_cast<char*>(&t),sizeof(T));
    }
 
    template<typename T>
-   inline void write_to_stream(std::ofstream& stream,const T& t)
+   static inline void write_to_stream(std::ofstream& stream,const T& t)
    {
       stream.write(reinterpret_cast<const char*>(&t),sizeof(T));
    }
 
-   inline void read_bfh(std::ifstream& stream, bitmap_file_header& bfh)
+   /* the same for headers in a mapped file, the pointer is advanced past the value */
+   template<typename T>
+   static inline void read_from_stream(const unsigned char*& buffer,T& t)
+   {
+      std::memcpy(&t,buffer,sizeof(T));
+      buffer += sizeof(T);
+   }
+
+   template<typename T>
+   static inline void write_to_stream(unsigned char*& buffer,const T& t)
+   {
+      std::memcpy(buffer,&t,sizeof(T));
+      buffer += sizeof(T);
+   }
+
+   template<typename Stream>
+   static inline void read_bfh(Stream& stream, bitmap_file_header& bfh)
    {
       read_from_stream(stream,bfh.type);
       read_from_stream(stream,bfh.size);
@@ -1272,7 +1952,8 @@ private:
       }
    }
 
-   inline void write_bfh(std::ofstream& stream, const bitmap_file_header& bfh)
+   template<typename Stream>
+   static inline void write_bfh(Stream& stream, const bitmap_file_header& bfh)
    {
       if (big_endian())
       {
@@ -1292,7 +1973,8 @@ private:
       }
    }
 
-   inline void read_bih(std::ifstream& stream,bitmap_information_header& bih)
+   template<typename Stream>
+   static inline void read_bih(Stream& stream,bitmap_information_header& bih)
    {
       read_from_stream(stream,bih.size  );
       read_from_stream(stream,bih.width );
@@ -1322,7 +2004,8 @@ private:
       }
    }
 
-   inline void write_bih(std::ofstream& stream, const bitmap_information_header& bih)
+   template<typename Stream>
+   static inline void write_bih(Stream& stream, const bitmap_information_header& bih)
    {
       if (big_endian())
       {
@@ -1356,13 +2039,10 @@ private:
 
    void create_bitmap()
    {
-      length_        = width_ * height_ * bytes_per_pixel_;
-      row_increment_ = width_ * bytes_per_pixel_;
+      row_increment_ = static_cast<std::size_t>(width_) * bytes_per_pixel_;
+      length_        = row_increment_ * height_;
 
-      if (0 != data_)
-      {
-         delete[] data_;
-      }
+      release_data();
 
       data_ = new unsigned char[length_];
    }
@@ -1390,46 +2070,1092 @@ private:
          return;
       }
 
+      if ((bih.bit_count != 24) && (bih.bit_count != 8) && (bih.bit_count != 1))
+      {
+         stream.close();
+         std::cerr << "bitmap_image::load_bitmap() ERROR: bitmap_image - Invalid bit depth " << bih.bit_count << " expected 1, 8 or 24." << std::endl;
+
+         return;
+      }
+
+      /* a negative height marks rows stored top-down */
+      const bool top_down = (static_cast<int>(bih.height) < 0);
+
+      height_ = top_down ? (0 - bih.height) : bih.height;
+      width_  = bih.width;
+
+      if (bih.bit_count != 24)
+      {
+         load_indexed_bitmap(stream,bfh,bih,top_down);
+         return;
+      }
+
+      bytes_per_pixel_ = bih.bit_count >> 3;
+
+      unsigned int padding = (4 - ((3 * width_) % 4)) % 4;
+      char padding_data[4] = {0,0,0,0};
+
+      create_bitmap();
+
+      for (unsigned int i = 0; i < height_; ++i)
+      {
+         unsigned char* data_ptr = row(top_down ? i : height_ - i - 1); // bottom-up files are read in inverted row order
+
+         stream.read(reinterpret_cast<char*>(data_ptr),sizeof(char) * bytes_per_pixel_ * width_);
+         stream.read(padding_data,padding);
+      }
+   }
+
+   /*
+      Palettized 1 and 8 bit images are expanded to 24 bits per pixel
+      on load. One bit rows go through the mask expansion eight pixels
+      at a time, byte rows through a 256 entry color table.
+   */
+   void load_indexed_bitmap(std::ifstream& stream,
+                            const bitmap_file_header& bfh,
+                            const bitmap_information_header& bih,
+                            const bool top_down)
+   {
+      const unsigned int bits        = bih.bit_count;
+      const unsigned int max_colors  = 1u << bits;
+      const unsigned int colors      = ((0 == bih.clr_used) || (bih.clr_used > max_colors)) ? max_colors : bih.clr_used;
+      const std::size_t  file_row    = ((static_cast<std::size_t>(width_) * bits + 31) / 32) * 4;
+
+      /* entries are blue, green, red and one unused byte, missing ones stay black */
+      unsigned char palette[256][4];
+      std::memset(palette,0,sizeof(palette));
+
+      stream.seekg(bfh.struct_size() + bih.size);
+      stream.read(reinterpret_cast<char*>(palette),4 * colors);
+      stream.seekg(bfh.off_bits);
+
+      bytes_per_pixel_ = 3;
+      channel_mode_    = bgr_mode;
+
+      create_bitmap();
+
+      std::vector<unsigned char> file_bytes(file_row);
+      std::vector<uint64_t> words((width_ + 63) / 64 + 1,0);
+
+      const rgb_store unset_color = { palette[0][2], palette[0][1], palette[0][0] };
+      const rgb_store set_color   = { palette[1][2], palette[1][1], palette[1][0] };
+
+      static const reversed_bits reversed;
+
+      for (unsigned int i = 0; i < height_; ++i)
+      {
+         const unsigned int row_index = top_down ? i : height_ - i - 1;
+
+         stream.read(reinterpret_cast<char*>(&file_bytes[0]),file_row);
+
+         if (1 == bits)
+         {
+            /* the leftmost pixel is the most significant bit of a file byte */
+            for (std::size_t b = 0; b < (width_ + 7) / 8; ++b)
+            {
+               if (0 == (b % 8))
+               {
+                  words[b / 8] = 0;
+               }
+
+               words[b / 8] |= static_cast<uint64_t>(reversed.table[file_bytes[b]]) << (8 * (b % 8));
+            }
+
+            import_bit_mask_row(row_index,&words[0],set_color,unset_color);
+         }
+         else
+         {
+            unsigned char* itr = row(row_index);
+
+            for (unsigned int x = 0; x < width_; ++x, itr += 3)
+            {
+               std::memcpy(itr,palette[file_bytes[x]],3);
+            }
+         }
+      }
+
+      if (!stream)
+      {
+         std::cerr << "bitmap_image::load_bitmap() ERROR: bitmap_image - file " << file_name_ << " is truncated." << std::endl;
+      }
+   }
+
+   void map_bitmap(const mapping_mode mode)
+   {
+      #if defined(BITMAP_IMAGE_MMAP)
+      const int fd = ::open(file_name_.c_str(),O_RDONLY);
+
+      if (fd < 0)
+      {
+         std::cerr << "bitmap_image::map_bitmap() ERROR: bitmap_image - file " << file_name_ << " not found!" << std::endl;
+         return;
+      }
+
+      struct stat file_status;
+
+      if ((0 != ::fstat(fd,&file_status)) || (file_status.st_size < 54))
+      {
+         ::close(fd);
+         std::cerr << "bitmap_image::map_bitmap() ERROR: bitmap_image - file " << file_name_ << " is too small." << std::endl;
+         return;
+      }
+
+      const std::size_t file_length = static_cast<std::size_t>(file_status.st_size);
+      const int protection = (copy_on_write_mapping == mode) ? (PROT_READ | PROT_WRITE) : PROT_READ;
+
+      void* mapping = ::mmap(0,file_length,protection,MAP_PRIVATE,fd,0);
+
+      ::close(fd);
+
+      if (MAP_FAILED == mapping)
+      {
+         std::cerr << "bitmap_image::map_bitmap() ERROR: bitmap_image - Could not map file " << file_name_ << std::endl;
+         return;
+      }
+
+      const unsigned char* buffer = static_cast<const unsigned char*>(mapping);
+
+      bitmap_file_header bfh;
+      bitmap_information_header bih;
+
+      read_bfh(buffer,bfh);
+      read_bih(buffer,bih);
+
+      if (bfh.type != 19778)
+      {
+         ::munmap(mapping,file_length);
+         std::cerr << "bitmap_image::map_bitmap() ERROR: bitmap_image - Invalid type value " << bfh.type << " expected 19778." << std::endl;
+         return;
+      }
+
       if (bih.bit_count != 24)
       {
-         stream.close();
-         std::cerr << "bitmap_image::load_bitmap() ERROR: bitmap_image - Invalid bit depth " << bih.bit_count << " expected 24." << std::endl;
+         /* palettized images are expanded anyway, nothing to gain from the mapping */
+         ::munmap(mapping,file_length);
+         load_bitmap();
+         return;
+      }
+
+      const bool top_down = (static_cast<int>(bih.height) < 0);
+
+      const unsigned int height     = top_down ? (0 - bih.height) : bih.height;
+      const std::size_t  row_length = static_cast<std::size_t>(bih.width) * 3;
+      const std::size_t  padding    = (4 - (row_length % 4)) % 4;
+
+      if ((bfh.off_bits + (row_length + padding) * height) > file_length)
+      {
+         ::munmap(mapping,file_length);
+         std::cerr << "bitmap_image::map_bitmap() ERROR: bitmap_image - file " << file_name_ << " is truncated." << std::endl;
+         return;
+      }
+
+      width_           = bih.width;
+      height_          = height;
+      bytes_per_pixel_ = 3;
+
+      unsigned char* pixels = static_cast<unsigned char*>(mapping) + bfh.off_bits;
+
+      if (top_down && (0 == padding))
+      {
+         /* the file layout matches the in-memory layout, use the pixels in place */
+         release_data();
+
+         data_           = pixels;
+         length_         = row_length * height_;
+         row_increment_  = row_length;
+         mapping_        = mapping;
+         mapping_length_ = file_length;
+
+         return;
+      }
+
+      ::madvise(mapping,file_length,MADV_SEQUENTIAL);
+
+      create_bitmap();
+
+      for (unsigned int i = 0; i < height_; ++i)
+      {
+         std::memcpy(row(top_down ? i : height_ - i - 1),pixels + (row_length + padding) * i,row_length);
+      }
+
+      ::munmap(mapping,file_length);
+      #else
+      (void)mode;
+      load_bitmap();
+      #endif
+   }
+
+   void release_data()
+   {
+      #if defined(BITMAP_IMAGE_MMAP)
+      if (0 != mapping_)
+      {
+         ::munmap(mapping_,mapping_length_);
+
+         data_           = 0;
+         mapping_        = 0;
+         mapping_length_ = 0;
+
+         return;
+      }
+      #endif
+
+      delete[] data_;
+      data_ = 0;
+   }
+
+   inline void reverse_channels()
+   {
+      if (3 != bytes_per_pixel_)
+         return;
+
+      for (unsigned char* itr = data_; itr < (data_ + length_); itr += bytes_per_pixel_)
+      {
+         unsigned char tmp = *(itr + 0);
+
+         *(itr + 0) = *(itr + 2);
+         *(itr + 2) = tmp;
+      }
+   }
+
+   /*
+      Eight pixels of a mask take 24 bytes, i.e. three 64-bit words. Each
+      word is the unset color pattern with the bytes of set pixels swapped
+      for the set color, selected by a byte mask looked up from the three
+      or four mask bits that fall into the word.
+   */
+   struct mask_pattern
+   {
+      unsigned char set  [3];
+      unsigned char unset[3];
+      uint64_t unset_words[3];
+      uint64_t diff_words [3];
+   };
+
+   struct mask_expansion
+   {
+      mask_expansion()
+      {
+         fill(first , 8,0,0);
+         fill(second,16,1,2);
+         fill(third , 8,2,5);
+      }
+
+      // word covers bytes 8 * word to 8 * word + 7, first_pixel is the pixel of its first byte
+      void fill(uint64_t* table, const unsigned int size, const unsigned int word, const unsigned int first_pixel)
+      {
+         for (unsigned int bits = 0; bits < size; ++bits)
+         {
+            unsigned char bytes[8];
+
+            for (unsigned int i = 0; i < 8; ++i)
+            {
+               const unsigned int pixel = (8 * word + i) / 3;
+               bytes[i] = ((bits >> (pixel - first_pixel)) & 1) ? 0xFF : 0x00;
+            }
+
+            std::memcpy(&table[bits],bytes,8);
+         }
+      }
+
+      uint64_t first [ 8];  // pixels 0 to 2
+      uint64_t second[16];  // pixels 2 to 5
+      uint64_t third [ 8];  // pixels 5 to 7
+   };
+
+   inline mask_pattern make_mask_pattern(const rgb_store& set_color, const rgb_store& unset_color) const
+   {
+      return make_mask_pattern(set_color,unset_color,channel_mode_);
+   }
+
+   static inline mask_pattern make_mask_pattern(const rgb_store& set_color, const rgb_store& unset_color, const channel_mode mode)
+   {
+      mask_pattern pattern;
+      const unsigned int red   = (rgb_mode == mode) ? 0 : 2;
+      const unsigned int blue  = 2 - red;
+
+      pattern.set  [red  ] = set_color.red;
+      pattern.set  [1    ] = set_color.green;
+      pattern.set  [blue ] = set_color.blue;
+      pattern.unset[red  ] = unset_color.red;
+      pattern.unset[1    ] = unset_color.green;
+      pattern.unset[blue ] = unset_color.blue;
+
+      unsigned char set_block  [24];
+      unsigned char unset_block[24];
+
+      for (unsigned int i = 0; i < 24; ++i)
+      {
+         set_block  [i] = pattern.set  [i % 3];
+         unset_block[i] = pattern.unset[i % 3];
+      }
+
+      std::memcpy(pattern.unset_words,unset_block,24);
+      std::memcpy(pattern.diff_words ,set_block  ,24);
+
+      for (unsigned int i = 0; i < 3; ++i)
+      {
+         pattern.diff_words[i] ^= pattern.unset_words[i];
+      }
+
+      return pattern;
+   }
+
+   static inline void write_mask_block(const unsigned int bits, const mask_pattern& pattern, unsigned char* itr)
+   {
+      static const mask_expansion expansion;
+
+      const uint64_t words[3] = {
+                                   pattern.unset_words[0] ^ (pattern.diff_words[0] & expansion.first [ bits       & 0x07]),
+                                   pattern.unset_words[1] ^ (pattern.diff_words[1] & expansion.second[(bits >> 2) & 0x0F]),
+                                   pattern.unset_words[2] ^ (pattern.diff_words[2] & expansion.third [(bits >> 5) & 0x07])
+                                };
+
+      std::memcpy(itr,words,24);
+   }
+
+   // width pixels of a bit mask row as 24 bit pixels at itr
+   static inline void expand_bit_mask_row(const uint64_t* bits, const unsigned int width, const mask_pattern& pattern, unsigned char* itr)
+   {
+      unsigned int x = 0;
+
+      for (; (x + 8) <= width; x += 8, itr += 24)
+      {
+         write_mask_block(static_cast<unsigned int>((bits[x / 64] >> (x % 64)) & 0xFF),pattern,itr);
+      }
+
+      for (; x < width; ++x, itr += 3)
+      {
+         std::memcpy(itr,((bits[x / 64] >> (x % 64)) & 1) ? pattern.set : pattern.unset,3);
+      }
+   }
+
+   /*
+      Writes the headers of a 24 bit bitmap and then its rows bottom-up,
+      fill_row(row_index, file_row) fills the pixels of one row and the
+      padding is cleared. The file is sized up front and the rows are
+      filled in place in a shared mapping of it, or through one row
+      buffer and a stream where that is not possible. The blocks of the
+      file are allocated before it is mapped, so a full disk is an error
+      and not a SIGBUS while writing through the mapping. Systems without
+      posix_fallocate always use the stream.
+   */
+   template<typename FillRow>
+   static bool save_rows_mapped(const std::string& file_name,
+                                const unsigned int width,
+                                const unsigned int height,
+                                const FillRow& fill_row)
+   {
+      bitmap_file_header bfh;
+      bitmap_information_header bih;
+
+      bih.width            = width;
+      bih.height           = height;
+      bih.bit_count        = 24;
+      bih.clr_important    =  0;
+      bih.clr_used         =  0;
+      bih.compression      =  0;
+      bih.planes           =  1;
+      bih.size             = 40;
+      bih.x_pels_per_meter =  0;
+      bih.y_pels_per_meter =  0;
+      bih.size_image       = (((bih.width * 3) + 3) & ~3u) * bih.height;
+
+      bfh.type      = 19778;
+      bfh.size      = 54 + bih.size_image;
+      bfh.reserved1 = 0;
+      bfh.reserved2 = 0;
+      bfh.off_bits  = bih.struct_size() + bfh.struct_size();
+
+      const std::size_t row_length  = static_cast<std::size_t>(width) * 3;
+      const std::size_t padding     = (4 - (row_length % 4)) % 4;
+
+      #if defined(BITMAP_IMAGE_MMAP)
+      const std::size_t file_length = bfh.off_bits + (row_length + padding) * height;
+
+      const int fd = ::open(file_name.c_str(),O_RDWR | O_CREAT | O_TRUNC,0644);
+
+      if (fd < 0)
+      {
+         return false;
+      }
+
+      void* mapping = MAP_FAILED;
+
+      #if defined(__linux__)
+      if (0 == ::posix_fallocate(fd,0,static_cast<off_t>(file_length)))
+      {
+         mapping = ::mmap(0,file_length,PROT_READ | PROT_WRITE,MAP_SHARED,fd,0);
+      }
+      #endif
+
+      ::close(fd);
+
+      if (MAP_FAILED != mapping)
+      {
+         unsigned char* buffer = static_cast<unsigned char*>(mapping);
+
+         write_bfh(buffer,bfh);
+         write_bih(buffer,bih);
+
+         for (unsigned int i = 0; i < height; ++i)
+         {
+            fill_row(height - i - 1,buffer);
+            std::memset(buffer + row_length,0x00,padding);
+            buffer += row_length + padding;
+         }
+
+         ::munmap(mapping,file_length);
+         return true;
+      }
+      #endif
+
+      std::ofstream stream(file_name.c_str(),std::ios::binary);
+
+      if (!stream)
+      {
+         return false;
+      }
+
+      write_bfh(stream,bfh);
+      write_bih(stream,bih);
+
+      std::vector<unsigned char> file_row(row_length + padding,0x00);
+
+      for (unsigned int i = 0; i < height; ++i)
+      {
+         fill_row(height - i - 1,&file_row[0]);
+         stream.write(reinterpret_cast<const char*>(&file_row[0]),file_row.size());
+      }
+
+      return !!stream;
+   }
+
+   // Bit order of a byte reversed, bitmaps store the leftmost pixel in the top bit
+   struct reversed_bits
+   {
+      reversed_bits()
+      {
+         for (unsigned int bits = 0; bits < 256; ++bits)
+         {
+            unsigned char reversed = 0;
+
+            for (unsigned int i = 0; i < 8; ++i)
+            {
+               reversed |= static_cast<unsigned char>(((bits >> i) & 1) << (7 - i));
+            }
+
+            table[bits] = reversed;
+         }
+      }
+
+      unsigned char table[256];
+   };
+
+   static inline void write_indexed_header(std::ofstream& stream,
+                                           const unsigned int width,
+                                           const unsigned int height,
+                                           const unsigned short bits,
+                                           const unsigned int colors)
+   {
+      bitmap_file_header bfh;
+      bitmap_information_header bih;
+
+      bih.width            = width;
+      bih.height           = height;
+      bih.bit_count        = bits;
+      bih.clr_important    =  0;
+      bih.clr_used         = colors;
+      bih.compression      =  0;
+      bih.planes           =  1;
+      bih.size             = 40;
+      bih.x_pels_per_meter =  0;
+      bih.y_pels_per_meter =  0;
+      bih.size_image       = static_cast<unsigned int>(((static_cast<std::size_t>(width) * bits + 31) / 32) * 4 * height);
+
+      bfh.type      = 19778;
+      bfh.reserved1 = 0;
+      bfh.reserved2 = 0;
+      bfh.off_bits  = bih.struct_size() + bfh.struct_size() + 4 * colors;
+      bfh.size      = bfh.off_bits + bih.size_image;
+
+      write_bfh(stream,bfh);
+      write_bih(stream,bih);
+   }
+
+   /* blue, green and red of a pixel in the order of a palette entry */
+   inline uint32_t color_key(const unsigned char* pixel) const
+   {
+      const unsigned int red = (rgb_mode == channel_mode_) ? 0 : 2;
+
+      return  static_cast<uint32_t>(pixel[2 - red])        |
+             (static_cast<uint32_t>(pixel[1      ]) <<  8) |
+             (static_cast<uint32_t>(pixel[red    ]) << 16);
+   }
+
+   /* Sorted distinct colors of the image, false if there are more than 256 */
+   inline bool collect_palette(std::vector<uint32_t>& colors) const
+   {
+      colors.clear();
+
+      if (0 == length_)
+      {
+         return false;
+      }
+
+      uint32_t last_color = color_key(data_);
+      colors.push_back(last_color);
+
+      for (const unsigned char* itr = data_; itr < (data_ + length_); itr += bytes_per_pixel_)
+      {
+         const uint32_t color = color_key(itr);
+
+         if (color == last_color)
+            continue;
+
+         last_color = color;
+
+         const std::vector<uint32_t>::iterator position = std::lower_bound(colors.begin(),colors.end(),color);
+
+         if ((colors.end() == position) || (*position != color))
+         {
+            if (256 == colors.size())
+            {
+               return false;
+            }
+
+            colors.insert(position,color);
+         }
+      }
+
+      return true;
+   }
+
+   static inline unsigned int palette_index(const std::vector<uint32_t>& colors, const uint32_t color)
+   {
+      return static_cast<unsigned int>(std::lower_bound(colors.begin(),colors.end(),color) - colors.begin());
+   }
+
+   static inline void write_palette_entry(std::ofstream& stream, const rgb_store& color)
+   {
+      const unsigned char entry[4] = { color.blue, color.green, color.red, 0x00 };
+      stream.write(reinterpret_cast<const char*>(entry),4);
+   }
+
+   // Eight bits spread to eight bytes of 0 or 1
+   struct bit_bytes
+   {
+      bit_bytes()
+      {
+         for (unsigned int bits = 0; bits < 256; ++bits)
+         {
+            unsigned char bytes[8];
+
+            for (unsigned int i = 0; i < 8; ++i)
+            {
+               bytes[i] = static_cast<unsigned char>((bits >> i) & 1);
+            }
+
+            std::memcpy(&table[bits],bytes,8);
+         }
+      }
+
+      uint64_t table[256];
+   };
+
+   /*
+      Four pixels take twelve bytes. The table maps one bit per byte (set
+      if the byte is below the threshold) to one bit per pixel (set if all
+      its three bytes are).
+   */
+   struct threshold_table
+   {
+      threshold_table()
+      {
+         for (unsigned int bytes = 0; bytes < 4096; ++bytes)
+         {
+            unsigned char pixels = 0;
+
+            for (unsigned int i = 0; i < 4; ++i)
+            {
+               if (7 == ((bytes >> (3 * i)) & 7))
+               {
+                  pixels |= static_cast<unsigned char>(1 << i);
+               }
+            }
+
+            table[bytes] = pixels;
+         }
+      }
+
+      unsigned char table[4096];
+   };
+
+   #if defined(BITMAP_IMAGE_SSE2)
+   // One bit per pixel for the 16 pixels (48 bytes) at itr, set if all channels are below threshold
+   static inline unsigned int threshold_block(const unsigned char* itr, const unsigned char threshold)
+   {
+      static const threshold_table pixels;
+
+      if (0 == threshold)
+      {
+         return 0;
+      }
+
+      const __m128i limit = _mm_set1_epi8(static_cast<char>(threshold - 1));
+      uint64_t below = 0;
+
+      for (unsigned int i = 0; i < 3; ++i)
+      {
+         const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(itr + 16 * i));
+         const unsigned int bits = static_cast<unsigned int>(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_min_epu8(bytes,limit),bytes)));
+         below |= static_cast<uint64_t>(bits) << (16 * i);
+      }
+
+      return  static_cast<unsigned int>(pixels.table[ below        & 0xFFF])       |
+             (static_cast<unsigned int>(pixels.table[(below >> 12) & 0xFFF]) <<  4) |
+             (static_cast<unsigned int>(pixels.table[(below >> 24) & 0xFFF]) <<  8) |
+             (static_cast<unsigned int>(pixels.table[(below >> 36) & 0xFFF]) << 12);
+   }
+   #endif
+
+   struct grayscale_table
+   {
+      double weighted[3][256];  /* scaler times value for bytes 0, 1 and 2 of a pixel */
+   };
+
+   /* Threads worth using for rows of row_bytes each, 1 unless parallel_execution is set */
+   inline unsigned int worker_count(const execution_policy policy, const std::size_t row_bytes) const
+   {
+      if (0 == (policy & parallel_execution))
+      {
+         return 1;
+      }
+
+      /* less work than this does not pay for starting a thread */
+      const std::size_t min_bytes = 256 * 1024;
+
+      const std::size_t work    = std::max<std::size_t>(1,(row_bytes * height_) / min_bytes);
+      const std::size_t threads = std::max<std::size_t>(1,std::thread::hardware_concurrency());
+
+      return static_cast<unsigned int>(std::max<std::size_t>(1,std::min(std::min(work,threads),static_cast<std::size_t>(height_))));
+   }
+
+   /* Calls function(worker, begin, end) for one contiguous range of rows per worker */
+   template<typename Function>
+   static inline void for_each_row_range(const unsigned int workers, const unsigned int rows, const Function& function)
+   {
+      std::vector<std::thread> threads;
+
+      for (unsigned int worker = 1; worker < workers; ++worker)
+      {
+         threads.push_back(std::thread(function,
+                                       worker,
+                                       static_cast<unsigned int>((static_cast<uint64_t>(rows) *  worker     ) / workers),
+                                       static_cast<unsigned int>((static_cast<uint64_t>(rows) * (worker + 1)) / workers)));
+      }
+
+      function(0,0,static_cast<unsigned int>(rows / std::max(1u,workers)));
+
+      for (std::size_t i = 0; i < threads.size(); ++i)
+      {
+         threads[i].join();
+      }
+   }
+
+   inline void grayscale_rows(const grayscale_table& table, const unsigned int begin, const unsigned int end, const bool vectorized)
+   {
+      for (unsigned int r = begin; r < end; ++r)
+      {
+         unsigned char* itr = row(r);
+         unsigned char* itr_end = itr + row_increment_;
+
+         #if defined(BITMAP_IMAGE_SSE2)
+         if (vectorized)
+         {
+            /* two pixels per step, one in each double lane */
+            for (; (itr + 6) <= itr_end; itr += 6)
+            {
+               const __m128d red   = _mm_set_pd(table.weighted[2][itr[5]],table.weighted[2][itr[2]]);
+               const __m128d green = _mm_set_pd(table.weighted[1][itr[4]],table.weighted[1][itr[1]]);
+               const __m128d blue  = _mm_set_pd(table.weighted[0][itr[3]],table.weighted[0][itr[0]]);
+
+               const __m128i gray  = _mm_cvttpd_epi32(_mm_add_pd(_mm_add_pd(red,green),blue));
+
+               std::memset(itr    ,_mm_cvtsi128_si32(gray                  ),3);
+               std::memset(itr + 3,_mm_cvtsi128_si32(_mm_srli_si128(gray,4)),3);
+            }
+         }
+         #else
+         (void)vectorized;
+         #endif
+
+         for (; itr < itr_end; itr += 3)
+         {
+            const unsigned char gray_value = static_cast<unsigned char>(table.weighted[2][itr[2]] +
+                                                                        table.weighted[1][itr[1]] +
+                                                                        table.weighted[0][itr[0]]);
+            itr[0] = gray_value;
+            itr[1] = gray_value;
+            itr[2] = gray_value;
+         }
+      }
+   }
+
+   /*
+      Rows begin to end of the half sized image dest. Matches subsample(),
+      including its last row of an odd height image, which copies the
+      first half of the source row instead of averaging pixel pairs.
+   */
+   inline void subsample_rows(bitmap_image& dest, const unsigned int begin, const unsigned int end) const
+   {
+      const unsigned int horizontal_upper = width_  / 2;
+      const unsigned int vertical_upper   = height_ / 2;
+      const bool odd_width = (0 != (width_ % 2));
+
+      for (unsigned int j = begin; j < end; ++j)
+      {
+         unsigned char* s_itr = dest.row(j);
+
+         if (j < vertical_upper)
+         {
+            const unsigned char* itr1 = row(2 * j);
+            const unsigned char* itr2 = row(2 * j + 1);
+
+            for (unsigned int i = 0; i < horizontal_upper; ++i, itr1 += 6, itr2 += 6, s_itr += 3)
+            {
+               for (unsigned int k = 0; k < 3; ++k)
+               {
+                  const unsigned int total = itr1[k] + itr1[k + 3] + itr2[k] + itr2[k + 3];
+                  s_itr[k] = static_cast<unsigned char>(total >> 2);
+               }
+            }
+
+            if (odd_width)
+            {
+               for (unsigned int k = 0; k < 3; ++k)
+               {
+                  s_itr[k] = static_cast<unsigned char>((itr1[k] + itr2[k]) >> 1);
+               }
+            }
+         }
+         else
+         {
+            std::memcpy(s_itr,row(height_ - 1),dest.row_increment_);
+         }
+      }
+   }
+
+   /* Source rows begin to end, each written to two rows of dest */
+   inline void upsample_rows(bitmap_image& dest, const unsigned int begin, const unsigned int end) const
+   {
+      for (unsigned int j = begin; j < end; ++j)
+      {
+         const unsigned char* s_itr = row(j);
+         unsigned char* itr = dest.row(2 * j);
+
+         for (unsigned int i = 0; i < width_; ++i, s_itr += 3, itr += 6)
+         {
+            std::memcpy(itr    ,s_itr,3);
+            std::memcpy(itr + 3,s_itr,3);
+         }
+
+         std::memcpy(dest.row(2 * j + 1),dest.row(2 * j),dest.row_increment_);
+      }
+   }
+
+   inline void alpha_blend_rows(const double alpha, const bitmap_image& image,
+                                const unsigned int begin, const unsigned int end, const bool vectorized)
+   {
+      const double alpha_compliment = 1.0 - alpha;
+
+      unsigned char* itr1     = row(begin);
+      unsigned char* itr1_end = row(end);
+      const unsigned char* itr2 = image.row(begin);
+
+      #if defined(BITMAP_IMAGE_SSE2)
+      if (vectorized)
+      {
+         const __m128d a = _mm_set1_pd(alpha);
+         const __m128d c = _mm_set1_pd(alpha_compliment);
+         const __m128i zero = _mm_setzero_si128();
+
+         /* eight bytes per step, widened to four pairs of doubles */
+         for (; (itr1 + 8) <= itr1_end; itr1 += 8, itr2 += 8)
+         {
+            const __m128i dst = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(itr1)),zero);
+            const __m128i src = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(itr2)),zero);
+
+            __m128i words[2];
+
+            for (unsigned int half = 0; half < 2; ++half)
+            {
+               const __m128i d = half ? _mm_unpackhi_epi16(dst,zero) : _mm_unpacklo_epi16(dst,zero);
+               const __m128i s = half ? _mm_unpackhi_epi16(src,zero) : _mm_unpacklo_epi16(src,zero);
+
+               const __m128i low  = _mm_cvttpd_epi32(_mm_add_pd(_mm_mul_pd(a,_mm_cvtepi32_pd(s)),
+                                                                _mm_mul_pd(c,_mm_cvtepi32_pd(d))));
+               const __m128i high = _mm_cvttpd_epi32(_mm_add_pd(_mm_mul_pd(a,_mm_cvtepi32_pd(_mm_srli_si128(s,8))),
+                                                                _mm_mul_pd(c,_mm_cvtepi32_pd(_mm_srli_si128(d,8)))));
+
+               words[half] = _mm_unpacklo_epi64(low,high);
+            }
+
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(itr1),_mm_packus_epi16(_mm_packs_epi32(words[0],words[1]),zero));
+         }
+      }
+      #else
+      (void)vectorized;
+      #endif
+
+      for (; itr1 != itr1_end; ++itr1, ++itr2)
+      {
+         *(itr1) = static_cast<unsigned char>((alpha * (*itr2)) + (alpha_compliment * (*itr1)));
+      }
+   }
+
+   inline uint64_t squared_error_rows(const bitmap_image& image,
+                                      const unsigned int begin, const unsigned int end, const bool vectorized) const
+   {
+      const unsigned char* itr1     = row(begin);
+      const unsigned char* itr1_end = row(end);
+      const unsigned char* itr2     = image.row(begin);
+
+      uint64_t sum = 0;
+
+      #if defined(BITMAP_IMAGE_SSE2)
+      if (vectorized)
+      {
+         const __m128i zero = _mm_setzero_si128();
+
+         while ((itr1 + 16) <= itr1_end)
+         {
+            /* a lane gains at most 4 * 255^2 per step, flush before it overflows */
+            const unsigned char* block_end = itr1 + 16 * std::min<std::size_t>(4096,(itr1_end - itr1) / 16);
+
+            __m128i acc = zero;
+
+            for (; itr1 != block_end; itr1 += 16, itr2 += 16)
+            {
+               const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(itr1));
+               const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(itr2));
+
+               const __m128i low  = _mm_sub_epi16(_mm_unpacklo_epi8(a,zero),_mm_unpacklo_epi8(b,zero));
+               const __m128i high = _mm_sub_epi16(_mm_unpackhi_epi8(a,zero),_mm_unpackhi_epi8(b,zero));
+
+               acc = _mm_add_epi32(acc,_mm_add_epi32(_mm_madd_epi16(low,low),_mm_madd_epi16(high,high)));
+            }
+
+            uint32_t lanes[4];
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes),acc);
+
+            sum += static_cast<uint64_t>(lanes[0]) + lanes[1] + lanes[2] + lanes[3];
+         }
+      }
+      #else
+      (void)vectorized;
+      #endif
+
+      for (; itr1 != itr1_end; ++itr1, ++itr2)
+      {
+         const int v = static_cast<int>(*itr1) - static_cast<int>(*itr2);
+         sum += static_cast<uint64_t>(v * v);
+      }
+
+      return sum;
+   }
+
+   inline void histogram_rows(const unsigned int channel, unsigned int counts[256],
+                              const unsigned int begin, const unsigned int end, const bool vectorized) const
+   {
+      const unsigned char* itr     = row(begin) + channel;
+      const unsigned char* itr_end = row(end);
+
+      if (vectorized)
+      {
+         /* four interleaved tables, so runs of equal values do not wait on each other */
+         unsigned int partial[4][256];
+         std::memset(partial,0,sizeof(partial));
+
+         for (; (itr + 3 * bytes_per_pixel_) < itr_end; itr += 4 * bytes_per_pixel_)
+         {
+            ++partial[0][itr[0                   ]];
+            ++partial[1][itr[    bytes_per_pixel_]];
+            ++partial[2][itr[2 * bytes_per_pixel_]];
+            ++partial[3][itr[3 * bytes_per_pixel_]];
+         }
+
+         for (unsigned int i = 0; i < 256; ++i)
+         {
+            counts[i] += partial[0][i] + partial[1][i] + partial[2][i] + partial[3][i];
+         }
+      }
+
+      for (; itr < itr_end; itr += bytes_per_pixel_)
+      {
+         ++counts[*itr];
+      }
+   }
+
+   /* color in the byte order of a pixel, the fourth byte is 0 */
+   inline uint32_t pack_color(const rgb_store& color) const
+   {
+      const unsigned int red = (rgb_mode == channel_mode_) ? 0 : 2;
+
+      unsigned char bytes[4] = { 0x00, 0x00, 0x00, 0x00 };
+      bytes[red    ] = color.red;
+      bytes[1      ] = color.green;
+      bytes[2 - red] = color.blue;
+
+      uint32_t packed;
+      std::memcpy(&packed,bytes,4);
+
+      return packed;
+   }
+
+   /*
+      Writes the packed colors of a row. All but the last pixel are
+      stored as four bytes, the spare byte is overwritten by the next
+      pixel, so no store crosses into the next row of another thread.
+   */
+   template<typename Index>
+   inline void write_packed_row(unsigned char* itr, const uint32_t* colors, unsigned int x, const Index& index) const
+   {
+      for (; (x + 1) < width_; ++x, itr += 3)
+      {
+         std::memcpy(itr,&colors[index(x)],4);
+      }
+
+      if (x < width_)
+      {
+         std::memcpy(itr,&colors[index(x)],3);
+      }
+   }
+
+   inline void colormap_rows(const float* field, const float lower, const float scale, const std::vector<uint32_t>& colors,
+                             const unsigned int begin, const unsigned int end, const bool vectorized)
+   {
+      const float last = static_cast<float>(colors.size() - 1);
+
+      for (unsigned int r = begin; r < end; ++r)
+      {
+         const float* values = field + static_cast<std::size_t>(width_) * r;
+         unsigned int x = 0;
+
+         #if defined(BITMAP_IMAGE_AVX2)
+         if (vectorized && has_avx2())
+         {
+            x = colormap_row_avx2(values,lower,scale,last,&colors[0],row(r));
+         }
+         #else
+         (void)vectorized;
+         #endif
+
+         write_packed_row(row(r) + 3 * x,&colors[0],x,[&](const unsigned int i) -> unsigned int
+                          {
+                             float position = (values[i] - lower) * scale;
+
+                             if (!(position > 0.0f)) position = 0.0f;
+                             if (position > last)    position = last;
+
+                             return static_cast<unsigned int>(position);
+                          });
+      }
+   }
+
+   inline void colormap_rows(const uint16_t* field, const uint16_t lower, const uint16_t upper, const std::vector<uint32_t>& colors,
+                             const unsigned int begin, const unsigned int end, const bool vectorized)
+   {
+      for (unsigned int r = begin; r < end; ++r)
+      {
+         const uint16_t* values = field + static_cast<std::size_t>(width_) * r;
+         unsigned int x = 0;
 
-         return;
+         #if defined(BITMAP_IMAGE_AVX2)
+         if (vectorized && has_avx2())
+         {
+            x = colormap_row_avx2(values,lower,upper,&colors[0],row(r));
+         }
+         #else
+         (void)vectorized;
+         #endif
+
+         write_packed_row(row(r) + 3 * x,&colors[0],x,[&](const unsigned int i) -> unsigned int
+                          {
+                             return static_cast<unsigned int>(std::min(std::max(values[i],lower),upper) - lower);
+                          });
       }
+   }
 
-      height_ = bih.height;
-      width_  = bih.width;
+   #if defined(BITMAP_IMAGE_AVX2)
+   static inline bool has_avx2()
+   {
+      static const bool supported = __builtin_cpu_supports("avx2");
+      return supported;
+   }
 
-      bytes_per_pixel_ = bih.bit_count >> 3;
+   /*
+      Stores the eight gathered colors as 24 bytes, the four pixels of
+      each half with one 16 byte store whose last four bytes are
+      overwritten afterwards.
+   */
+   __attribute__((target("avx2")))
+   static inline void store_gathered(unsigned char* itr, const __m256i colors)
+   {
+      const __m256i packing = _mm256_setr_epi8(0,1,2,4,5,6,8,9,10,12,13,14,-1,-1,-1,-1,
+                                               0,1,2,4,5,6,8,9,10,12,13,14,-1,-1,-1,-1);
+      const __m256i packed  = _mm256_shuffle_epi8(colors,packing);
 
-      unsigned int padding = (4 - ((3 * width_) % 4)) % 4;
-      char padding_data[4] = {0,0,0,0};
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(itr     ),_mm256_castsi256_si128   (packed  ));
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(itr + 12),_mm256_extracti128_si256(packed,1));
+   }
 
-      create_bitmap();
+   /* Colors the pixels of a row eight at a time, returns the first pixel left over */
+   __attribute__((target("avx2")))
+   inline unsigned int colormap_row_avx2(const float* values, const float lower, const float scale, const float last,
+                                         const uint32_t* colors, unsigned char* itr) const
+   {
+      const __m256 low   = _mm256_set1_ps(lower);
+      const __m256 scl   = _mm256_set1_ps(scale);
+      const __m256 top   = _mm256_set1_ps(last);
+      const __m256 zero  = _mm256_setzero_ps();
 
-      for (unsigned int i = 0; i < height_; ++i)
+      unsigned int x = 0;
+
+      /* the stores reach four bytes past the eight pixels, stay inside the row */
+      for (; (x + 10) <= width_; x += 8, itr += 24)
       {
-         unsigned char* data_ptr = row(height_ - i - 1); // read in inverted row order
+         const __m256 position = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(values + x),low),scl);
 
-         stream.read(reinterpret_cast<char*>(data_ptr),sizeof(char) * bytes_per_pixel_ * width_);
-         stream.read(padding_data,padding);
+         /* max returns its second operand for NaN, so NaN ends up at 0 */
+         const __m256i index = _mm256_cvttps_epi32(_mm256_min_ps(_mm256_max_ps(position,zero),top));
+
+         store_gathered(itr,_mm256_i32gather_epi32(reinterpret_cast<const int*>(colors),index,4));
       }
+
+      return x;
    }
 
-   inline void reverse_channels()
+   __attribute__((target("avx2")))
+   inline unsigned int colormap_row_avx2(const uint16_t* values, const uint16_t lower, const uint16_t upper,
+                                         const uint32_t* colors, unsigned char* itr) const
    {
-      if (3 != bytes_per_pixel_)
-         return;
+      const __m256i low  = _mm256_set1_epi32(lower);
+      const __m256i high = _mm256_set1_epi32(upper);
 
-      for (unsigned char* itr = data_; itr < (data_ + length_); itr += bytes_per_pixel_)
+      unsigned int x = 0;
+
+      for (; (x + 10) <= width_; x += 8, itr += 24)
       {
-         unsigned char tmp = *(itr + 0);
+         const __m256i value = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(values + x)));
+         const __m256i index = _mm256_sub_epi32(_mm256_min_epi32(_mm256_max_epi32(value,low),high),low);
 
-         *(itr + 0) = *(itr + 2);
-         *(itr + 2) = tmp;
+         store_gathered(itr,_mm256_i32gather_epi32(reinterpret_cast<const int*>(colors),index,4));
       }
+
+      return x;
    }
+   #endif
 
    template<typename T>
    inline T clamp(const T& v, const T& lower_range, const T& upper_range)
@@ -1444,20 +3170,14 @@ private:
 
    std::string    file_name_;
    unsigned char* data_;
-   unsigned int   length_;
+   std::size_t    length_;
    unsigned int   width_;
    unsigned int   height_;
-   unsigned int   row_increment_;
+   std::size_t    row_increment_;
    unsigned int   bytes_per_pixel_;
    channel_mode   channel_mode_;
-};
-
-
-struct rgb_store
-{
-   unsigned char red;
-   unsigned char green;
-   unsigned char blue;
+   void*          mapping_;         /* file mapping that data_ points into, if any */
+   std::size_t    mapping_length_;
 };
 
 inline void rgb_to_ycbcr(const unsigned int& length, double* red, double* green, double* blue,
@@ -1838,16 +3558,361 @@ inline void hierarchical_psnr(bitmap_image& image1,bitmap_image& image2, const d
    }
 }
 
+/*
+   Streams a 24-bit bitmap in horizontal strips of strip_height rows,
+   so images far larger than memory can be processed with a buffer of
+   width * (strip_height + 2 * overlap) pixels. Every strip also holds
+   up to overlap rows of its neighbours above and below, for kernels
+   that look at adjacent rows; the rows a strip is responsible for
+   start at overlap_above(). Strips are returned top to bottom for both
+   bottom-up and top-down files. File offsets are 64-bit and the size
+   fields of the headers are ignored, so files beyond 4 GB work.
+*/
+class bitmap_strip_reader
+{
+public:
+
+   bitmap_strip_reader(const std::string& file_name,
+                       const unsigned int strip_height,
+                       const unsigned int overlap = 0)
+   : stream_(file_name.c_str(),std::ios::binary),
+     strip_height_(std::max(1u,strip_height)),
+     overlap_(overlap),
+     width_(0),
+     height_(0),
+     top_down_(false),
+     row_length_(0),
+     padded_row_length_(0),
+     pixels_offset_(0),
+     next_row_(0),
+     strip_begin_(0),
+     strip_first_row_(0),
+     strip_rows_(0)
+   {
+      if (!stream_)
+      {
+         std::cerr << "bitmap_strip_reader() ERROR: bitmap_strip_reader - file " << file_name << " not found!" << std::endl;
+         return;
+      }
+
+      bitmap_image::bitmap_file_header bfh;
+      bitmap_image::bitmap_information_header bih;
+
+      bitmap_image::read_bfh(stream_,bfh);
+      bitmap_image::read_bih(stream_,bih);
+
+      if (!stream_ || (bfh.type != 19778) || (bih.bit_count != 24))
+      {
+         std::cerr << "bitmap_strip_reader() ERROR: bitmap_strip_reader - file " << file_name << " is not a 24-bit bitmap." << std::endl;
+         stream_.close();
+         return;
+      }
+
+      top_down_          = (static_cast<int>(bih.height) < 0);
+      width_             = bih.width;
+      height_            = top_down_ ? (0 - bih.height) : bih.height;
+      row_length_        = 3 * static_cast<std::size_t>(width_);
+      padded_row_length_ = (row_length_ + 3) & ~static_cast<std::size_t>(3);
+      pixels_offset_     = bfh.off_bits;
+   }
+
+   inline bool operator!() const
+   {
+      return !stream_.is_open() || (0 == width_) || (0 == height_);
+   }
+
+   inline unsigned int width() const
+   {
+      return width_;
+   }
+
+   inline unsigned int height() const
+   {
+      return height_;
+   }
+
+   /*
+      Reads the next strip into strip, reusing its buffer if the size
+      stays the same. Returns false once all rows have been read.
+   */
+   bool next_strip(bitmap_image& strip)
+   {
+      if (!(*this) || (next_row_ >= height_))
+      {
+         return false;
+      }
+
+      strip_first_row_ = next_row_;
+      strip_rows_      = std::min(strip_height_,height_ - next_row_);
+      strip_begin_     = strip_first_row_ - std::min(overlap_,strip_first_row_);
+      next_row_       += strip_rows_;
+
+      const unsigned int strip_end = next_row_ + std::min(overlap_,height_ - next_row_);
+      const unsigned int rows      = strip_end - strip_begin_;
+
+      if ((strip.width() != width_) || (strip.height() != rows))
+      {
+         strip.setwidth_height(width_,rows);
+      }
+
+      /* the rows of a strip are contiguous in the file, read them with one seek */
+      const unsigned int first_file_row = top_down_ ? strip_begin_ : (height_ - strip_end);
+
+      stream_.seekg(static_cast<std::streamoff>(pixels_offset_ + padded_row_length_ * first_file_row));
+
+      char padding_data[4];
+      const std::streamsize padding = static_cast<std::streamsize>(padded_row_length_ - row_length_);
+
+      for (unsigned int i = 0; i < rows; ++i)
+      {
+         unsigned char* data_ptr = strip.row(top_down_ ? i : rows - i - 1);
+
+         stream_.read(reinterpret_cast<char*>(data_ptr),static_cast<std::streamsize>(row_length_));
+         stream_.read(padding_data,padding);
+      }
+
+      if (!stream_)
+      {
+         std::cerr << "bitmap_strip_reader::next_strip() ERROR: bitmap_strip_reader - file is truncated." << std::endl;
+         stream_.close();
+         return false;
+      }
+
+      return true;
+   }
+
+   /* image row of the first row in the last strip, including overlap */
+   inline unsigned int strip_begin() const
+   {
+      return strip_begin_;
+   }
+
+   /* image row of the first row the last strip is responsible for */
+   inline unsigned int strip_first_row() const
+   {
+      return strip_first_row_;
+   }
+
+   /* overlap rows at the top of the last strip */
+   inline unsigned int overlap_above() const
+   {
+      return strip_first_row_ - strip_begin_;
+   }
+
+   /* rows of the last strip it is responsible for, without overlap */
+   inline unsigned int strip_rows() const
+   {
+      return strip_rows_;
+   }
+
+   inline void rewind()
+   {
+      stream_.clear();
+      next_row_ = 0;
+   }
+
+private:
+
+   bitmap_strip_reader(const bitmap_strip_reader&);
+   bitmap_strip_reader& operator=(const bitmap_strip_reader&);
+
+   std::ifstream stream_;
+   unsigned int  strip_height_;
+   unsigned int  overlap_;
+   unsigned int  width_;
+   unsigned int  height_;
+   bool          top_down_;
+   std::size_t   row_length_;
+   std::size_t   padded_row_length_;
+   uint64_t      pixels_offset_;
+   unsigned int  next_row_;
+   unsigned int  strip_begin_;
+   unsigned int  strip_first_row_;
+   unsigned int  strip_rows_;
+};
+
+/*
+   Writes a 24-bit bitmap of known size strip by strip, top to bottom.
+   The file is bottom-up like the ones from save_image, each strip is
+   written with one seek to where its rows belong. Size fields that do
+   not fit into 32 bits are written as 0, which readers accept for
+   uncompressed bitmaps.
+*/
+class bitmap_strip_writer
+{
+public:
+
+   bitmap_strip_writer(const std::string& file_name,
+                       const unsigned int width,
+                       const unsigned int height)
+   : stream_(file_name.c_str(),std::ios::binary),
+     width_(width),
+     height_(height),
+     row_length_(3 * static_cast<std::size_t>(width)),
+     padded_row_length_((3 * static_cast<std::size_t>(width) + 3) & ~static_cast<std::size_t>(3)),
+     pixels_offset_(0),
+     next_row_(0)
+   {
+      if (!stream_)
+      {
+         std::cerr << "bitmap_strip_writer() ERROR: bitmap_strip_writer - Could not open file " << file_name << " for writing!" << std::endl;
+         return;
+      }
+
+      bitmap_image::bitmap_file_header bfh;
+      bitmap_image::bitmap_information_header bih;
+
+      const uint64_t size_image = static_cast<uint64_t>(padded_row_length_) * height_;
+      const uint64_t max_size   = std::numeric_limits<unsigned int>::max();
+
+      bih.width            = width_;
+      bih.height           = height_;
+      bih.bit_count        = 24;
+      bih.clr_important    =  0;
+      bih.clr_used         =  0;
+      bih.compression      =  0;
+      bih.planes           =  1;
+      bih.size             = 40;
+      bih.x_pels_per_meter =  0;
+      bih.y_pels_per_meter =  0;
+      bih.size_image       = (size_image <= max_size) ? static_cast<unsigned int>(size_image) : 0;
+
+      bfh.type      = 19778;
+      bfh.reserved1 = 0;
+      bfh.reserved2 = 0;
+      bfh.off_bits  = bih.struct_size() + bfh.struct_size();
+      bfh.size      = ((bfh.off_bits + size_image) <= max_size) ? static_cast<unsigned int>(bfh.off_bits + size_image) : 0;
+
+      bitmap_image::write_bfh(stream_,bfh);
+      bitmap_image::write_bih(stream_,bih);
+
+      pixels_offset_ = bfh.off_bits;
+   }
+
+   inline bool operator!() const
+   {
+      return !stream_.is_open() || !stream_;
+   }
+
+   inline unsigned int rows_written() const
+   {
+      return next_row_;
+   }
+
+   /*
+      Appends rows first_row to first_row + rows of strip to the image,
+      all remaining rows of the strip by default. Strips from a
+      bitmap_strip_reader are written with write_strip(strip,
+      reader.overlap_above(), reader.strip_rows()).
+   */
+   bool write_strip(const bitmap_image& strip,
+                    const unsigned int first_row = 0,
+                    unsigned int rows = std::numeric_limits<unsigned int>::max())
+   {
+      if (!(*this) || (strip.width() != width_) || (first_row > strip.height()))
+      {
+         return false;
+      }
+
+      rows = std::min(rows,strip.height() - first_row);
+
+      if (rows > (height_ - next_row_))
+      {
+         std::cerr << "bitmap_strip_writer::write_strip() ERROR: bitmap_strip_writer - more rows than the image height." << std::endl;
+         return false;
+      }
+
+      /* the lowest image row of the strip comes first in the file */
+      const unsigned int first_file_row = height_ - (next_row_ + rows);
+
+      stream_.seekp(static_cast<std::streamoff>(pixels_offset_ + padded_row_length_ * first_file_row));
+
+      const char padding_data[4] = {0x0,0x0,0x0,0x0};
+      const std::streamsize padding = static_cast<std::streamsize>(padded_row_length_ - row_length_);
+
+      for (unsigned int i = 0; i < rows; ++i)
+      {
+         const unsigned char* data_ptr = strip.row(first_row + rows - i - 1);
+
+         stream_.write(reinterpret_cast<const char*>(data_ptr),static_cast<std::streamsize>(row_length_));
+         stream_.write(padding_data,padding);
+      }
+
+      next_row_ += rows;
+
+      return !!stream_;
+   }
+
+private:
+
+   bitmap_strip_writer(const bitmap_strip_writer&);
+   bitmap_strip_writer& operator=(const bitmap_strip_writer&);
+
+   std::ofstream stream_;
+   unsigned int  width_;
+   unsigned int  height_;
+   std::size_t   row_length_;
+   std::size_t   padded_row_length_;
+   uint64_t      pixels_offset_;
+   unsigned int  next_row_;
+};
+
+/*
+   Half sub-samples the bitmap input into output while holding at most
+   strip_height rows of it in memory. The result equals that of
+   subsample() on the whole image, strips are rounded up to an even
+   height so that no row pair is split.
+*/
+inline bool streamed_subsample(const std::string& input,
+                               const std::string& output,
+                               const unsigned int strip_height,
+                               const bitmap_image::execution_policy policy = bitmap_image::sequential_execution)
+{
+   bitmap_strip_reader reader(input,std::max(2u,strip_height + (strip_height % 2)));
+
+   if (!reader)
+   {
+      return false;
+   }
+
+   bitmap_strip_writer writer(output,(reader.width() + 1) / 2,(reader.height() + 1) / 2);
+
+   bitmap_image strip;
+   bitmap_image half;
+
+   while (reader.next_strip(strip))
+   {
+      strip.subsample(half,policy);
+
+      if (!writer.write_strip(half))
+      {
+         return false;
+      }
+   }
+
+   return (writer.rows_written() == ((reader.height() + 1) / 2));
+}
+
 class image_drawer
 {
 public:
 
+   struct segment
+   {
+      int x1;
+      int y1;
+      int x2;
+      int y2;
+   };
+
    image_drawer(bitmap_image& image)
    : image_(image),
      pen_width_(1),
      pen_color_red_  (0),
      pen_color_green_(0),
-     pen_color_blue_ (0)
+     pen_color_blue_ (0),
+     pen_low_ (0),
+     pen_high_(0)
    {}
 
    void rectangle(int x1, int y1, int x2, int y2)
@@ -1873,8 +3938,22 @@ public:
       line_segment(x4,y4,x1,y1);
    }
 
+   /*
+      Bresenham line including both end points. Only the steps whose pen
+      stamp can reach the image are visited: the first one is found from
+      the closed form of the error term instead of walking up to it, and
+      the walk stops once the line has left the image for good.
+   */
    void line_segment(int x1, int y1, int x2, int y2)
    {
+      if ((x1 == x2) || (y1 == y2))
+      {
+         /* axis aligned lines are a single span per pen row */
+         fill_clipped(std::min(x1,x2) + pen_low_ ,std::min(y1,y2) + pen_low_,
+                      std::max(x1,x2) + pen_high_,std::max(y1,y2) + pen_high_);
+         return;
+      }
+
       int steep = 0;
       int sx    = ((x2 - x1) > 0) ? 1 : -1;
       int sy    = ((y2 - y1) > 0) ? 1 : -1;
@@ -1889,28 +3968,64 @@ public:
          steep = 1;
       }
 
-      int e = 2 * dy - dx;
+      /* pen positions along each axis whose stamp overlaps the image */
+      const long long major_low  = -static_cast<long long>(pen_high_);
+      const long long major_high = static_cast<long long>(steep ? image_.height() : image_.width()) - 1 - pen_low_;
+      const long long minor_low  = -static_cast<long long>(pen_high_);
+      const long long minor_high = static_cast<long long>(steep ? image_.width() : image_.height()) - 1 - pen_low_;
+
+      long long first = (sx > 0) ? (major_low  - x1) : (x1 - major_high);
+      long long last  = (sx > 0) ? (major_high - x1) : (x1 - major_low );
 
-      for (int i = 0; i < dx; ++i)
+      first = std::max(first,0LL);
+      last  = std::min(last,static_cast<long long>(dx) - 1);
+
+      if (first <= last)
       {
-         if (steep)
-            plot_pen_pixel(y1,x1);
-         else
-            plot_pen_pixel(x1,y1);
+         /* the error term before step i, with k steps along the minor axis taken so far */
+         const long long e0 = 2LL * dy - dx;
+         const long long s  = e0 + 2LL * dy * (first - 1);
+         const long long k  = ((first > 0) && (s >= 0)) ? (s / (2LL * dx) + 1) : 0;
 
-         while (e >= 0)
+         int major = static_cast<int>(x1 + sx * first);
+         int minor = static_cast<int>(y1 + sy * k);
+         int e     = static_cast<int>(e0 + 2LL * dy * first - 2LL * dx * k);
+
+         for (long long i = first; i <= last; ++i)
          {
-            y1 += sy;
-            e -= (dx << 1);
-         }
+            if ((sy > 0) ? (minor > minor_high) : (minor < minor_low))
+            {
+               break; /* moving away from the image */
+            }
 
-         x1 += sx;
-         e  += (dy << 1);
+            if (steep)
+               plot_pen_pixel(minor,major);
+            else
+               plot_pen_pixel(major,minor);
+
+            while (e >= 0)
+            {
+               minor += sy;
+               e -= (dx << 1);
+            }
+
+            major += sx;
+            e     += (dy << 1);
+         }
       }
 
       plot_pen_pixel(x2,y2);
    }
 
+   /* Draws many segments, e.g. the routes of a map overlay */
+   void line_segments(const segment* segments, const std::size_t count)
+   {
+      for (std::size_t i = 0; i < count; ++i)
+      {
+         line_segment(segments[i].x1,segments[i].y1,segments[i].x2,segments[i].y2);
+      }
+   }
+
    void horiztonal_line_segment(int x1, int x2, int y)
    {
       if (x1 > x2)
@@ -1918,9 +4033,9 @@ public:
          std::swap(x1,x2);
       }
 
-      for (int i = 0; i < (x2 - x1); ++i)
+      if (x1 < x2)
       {
-         plot_pen_pixel(x1 +  i,y);
+         fill_clipped(x1 + pen_low_,y + pen_low_,x2 - 1 + pen_high_,y + pen_high_);
       }
    }
 
@@ -1931,9 +4046,9 @@ public:
          std::swap(y1,y2);
       }
 
-      for (int i = 0; i < (y2 - y1); ++i)
+      if (y1 < y2)
       {
-         plot_pen_pixel(x, y1 +  i);
+         fill_clipped(x + pen_low_,y1 + pen_low_,x + pen_high_,y2 - 1 + pen_high_);
       }
    }
 
@@ -2019,7 +4134,7 @@ public:
    void circle(int centerx, int centery, int radius)
    {
       int x = 0;
-      int d = (1 - radius) << 1;
+      int d = (1 - radius) * 2;
 
       while (radius >= 0)
       {
@@ -2029,50 +4144,63 @@ public:
          plot_pen_pixel(centerx - x,centery - radius);
 
          if ((d + radius) > 0)
-            d -= ((--radius) << 1) - 1;
+            d -= ((--radius) * 2) - 1;
          if (x > d)
             d += ((++x) << 1) + 1;
       }
    }
 
-   void plot_pen_pixel(int x, int y)
+   /* Fills the rectangle with the corners (x1,y1) and (x2,y2), both included */
+   void fill_rectangle(int x1, int y1, int x2, int y2)
    {
-      switch (pen_width_)
-      {
-         case 1  : plot_pixel(x,y);
-                   break;
+      fill_clipped(std::min(x1,x2),std::min(y1,y2),std::max(x1,x2),std::max(y1,y2));
+   }
 
-         case 2  : {
-                      plot_pixel(x    , y    );
-                      plot_pixel(x + 1, y    );
-                      plot_pixel(x + 1, y + 1);
-                      plot_pixel(x    , y + 1);
-                   }
-                   break;
+   /*
+      Fills all pixels with x^2 + y^2 <= radius^2 + radius around the
+      center, one span per row. The half width of the span only shrinks
+      from the middle row outwards, so it is found without square roots.
+   */
+   void fill_circle(int centerx, int centery, int radius)
+   {
+      if (radius < 0)
+      {
+         return;
+      }
 
-         case  3 : {
-                      plot_pixel(x    , y - 1);
-                      plot_pixel(x - 1, y - 1);
-                      plot_pixel(x + 1, y - 1);
+      const long long limit = static_cast<long long>(radius) * radius + radius;
+      long long half = radius;
 
-                      plot_pixel(x    , y    );
-                      plot_pixel(x - 1, y    );
-                      plot_pixel(x + 1, y    );
+      for (long long y = 0; y <= radius; ++y)
+      {
+         while ((half * half + y * y) > limit)
+         {
+            --half;
+         }
 
-                      plot_pixel(x    , y + 1);
-                      plot_pixel(x - 1, y + 1);
-                      plot_pixel(x + 1, y + 1);
-                   }
-                   break;
+         fill_clipped(centerx - half,centery + y,centerx + half,centery + y);
 
-         default : plot_pixel(x,y);
-                   break;
+         if (y > 0)
+         {
+            fill_clipped(centerx - half,centery - y,centerx + half,centery - y);
+         }
       }
    }
 
+   /* The pen is a square of pen_width pixels, the stamp is a clipped fill of it */
+   void plot_pen_pixel(int x, int y)
+   {
+      fill_clipped(x + pen_low_,y + pen_low_,x + pen_high_,y + pen_high_);
+   }
+
    void plot_pixel(int x, int y)
    {
-      image_.set_pixel(x,y,pen_color_red_,pen_color_green_,pen_color_blue_);
+      if ((x >= 0) && (y >= 0) &&
+          (static_cast<unsigned int>(x) < image_.width()) &&
+          (static_cast<unsigned int>(y) < image_.height()))
+      {
+         image_.set_pixel(x,y,pen_color_red_,pen_color_green_,pen_color_blue_);
+      }
    }
 
    void pen_width(const unsigned int& width)
@@ -2080,6 +4208,10 @@ public:
       if ((width > 0) && (width < 4))
       {
          pen_width_ = width;
+
+         /* width 2 covers (x,y) to (x+1,y+1), width 3 is centered */
+         pen_low_  = (3 == width) ? -1 : 0;
+         pen_high_ = (1 == width) ?  0 : 1;
       }
    }
 
@@ -2090,6 +4222,8 @@ public:
       pen_color_red_   = red;
       pen_color_green_ = green;
       pen_color_blue_  = blue;
+
+      color_row_.clear();
    }
 
 private:
@@ -2097,11 +4231,54 @@ private:
    image_drawer(const image_drawer& id);
    image_drawer& operator =(const image_drawer& id);
 
+   /*
+      Fills the pixels from (x1,y1) to (x2,y2), both included, that lie
+      within the image. Every row is one copy from a row of pen colored
+      pixels, which is built once per pen color and image width.
+   */
+   void fill_clipped(long long x1, long long y1, long long x2, long long y2)
+   {
+      const long long width  = image_.width();
+      const long long height = image_.height();
+
+      x1 = std::max(x1,0LL);
+      y1 = std::max(y1,0LL);
+      x2 = std::min(x2,width  - 1);
+      y2 = std::min(y2,height - 1);
+
+      if ((x1 > x2) || (y1 > y2))
+      {
+         return;
+      }
+
+      if (color_row_.size() != static_cast<std::size_t>(3 * width))
+      {
+         color_row_.resize(static_cast<std::size_t>(3 * width));
+
+         for (std::size_t i = 0; i < color_row_.size(); i += 3)
+         {
+            color_row_[i + 0] = pen_color_blue_;
+            color_row_[i + 1] = pen_color_green_;
+            color_row_[i + 2] = pen_color_red_;
+         }
+      }
+
+      const std::size_t bytes = static_cast<std::size_t>(3 * (x2 - x1 + 1));
+
+      for (long long y = y1; y <= y2; ++y)
+      {
+         std::memcpy(image_.row(static_cast<unsigned int>(y)) + 3 * x1,&color_row_[0],bytes);
+      }
+   }
+
    bitmap_image& image_;
    unsigned int  pen_width_;
    unsigned char pen_color_red_;
    unsigned char pen_color_green_;
    unsigned char pen_color_blue_;
+   int           pen_low_;     /* pen square relative to the plotted point */
+   int           pen_high_;
+   std::vector<unsigned char> color_row_;
 };
 
 const rgb_store autumn_colormap[1000] = {
@@ -0,0 +1,206 @@
+#include <iostream>
+#include <fstream>
+#include <cstring>
+#include <cstdlib>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+#include "benchmark_options.hpp"
+#include "bitmap_image.hpp"
+#include "counter_rng.hpp"
+
+// Measures the bitmap_image operations that take an execution policy on images of the
+// given sizes and prints one CSV line per operation, policy and size, e.g.
+//
+//   bitmap_image_benchmark -sizes 1024,8192x4096 -operations grayscale,psnr -o results.csv
+//
+// The speedup column compares against the sequential policy of the same operation and
+// size, so it is only filled in if sequential is among the measured policies.
+
+struct BenchmarkParameter : BenchmarkOptions
+{
+    BenchmarkParameter(int argc, char* argv[])
+        : BenchmarkOptions("1024,4096")
+    {
+        std::string operationsText = "grayscale,subsample,upsample,alpha_blend,psnr,histogram,colormap,colormap16";
+        std::string policiesText = "sequential,vectorized,parallel,parallel_vectorized";
+
+        parse(argc, argv, [&](const char* name, const char* value) {
+            if (!strcmp(name, "-operations"))
+            {
+                operationsText = value;
+            }
+            else if (!strcmp(name, "-policies"))
+            {
+                policiesText = value;
+            }
+        });
+
+        for (const std::string &operation : split(operationsText))
+        {
+            if (operation != "grayscale" && operation != "subsample" && operation != "upsample"
+                && operation != "alpha_blend" && operation != "psnr" && operation != "histogram"
+                && operation != "colormap" && operation != "colormap16")
+            {
+                std::cerr << "Unknown operation " << operation << " is skipped." << std::endl;
+                continue;
+            }
+            operations.push_back(operation);
+        }
+
+        const std::map<std::string, bitmap_image::execution_policy> names = {
+            { "sequential", bitmap_image::sequential_execution },
+            { "vectorized", bitmap_image::vectorized_execution },
+            { "parallel", bitmap_image::parallel_execution },
+            { "parallel_vectorized", bitmap_image::parallel_vectorized_execution }
+        };
+
+        for (const std::string &policy : split(policiesText))
+        {
+            if (!names.count(policy))
+            {
+                std::cerr << "Unknown policy " << policy << " is skipped." << std::endl;
+                continue;
+            }
+            policyNames.push_back(policy);
+            policies.push_back(names.at(policy));
+        }
+    }
+
+    std::vector<std::string> operations;
+    std::vector<std::string> policyNames;
+    std::vector<bitmap_image::execution_policy> policies;
+};
+
+// Fills the image with the same noise for every policy, so all of them see equal input
+void fillNoise(bitmap_image &image, const CounterRng &rng, CounterRng::Stream stream)
+{
+    std::vector<unsigned char> row(3 * image.width());
+
+    for (unsigned int y = 0; y < image.height(); ++y)
+    {
+        for (size_t x = 0; x < row.size(); x += 16)
+        {
+            uint32_t bits[4];
+            rng.generate(static_cast<uint32_t>(x / 16), y, 0, stream, bits);
+            memcpy(&row[x], bits, std::min<size_t>(16, row.size() - x));
+        }
+        for (unsigned int x = 0; x < image.width(); ++x)
+        {
+            image.set_pixel(x, y, row[3 * x + 2], row[3 * x + 1], row[3 * x]);
+        }
+    }
+}
+
+Timing benchmark(const std::string &operation, bitmap_image::execution_policy policy,
+                      const bitmap_image &source, const bitmap_image &other, double minSeconds)
+{
+    bitmap_image image(source);
+    bitmap_image result;
+    double sink[256];
+
+    if (operation == "grayscale")
+    {
+        return measure(minSeconds, [&]() { image.convert_to_grayscale(policy); });
+    }
+    if (operation == "subsample")
+    {
+        return measure(minSeconds, [&]() { image.subsample(result, policy); });
+    }
+    if (operation == "upsample")
+    {
+        return measure(minSeconds, [&]() { image.upsample(result, policy); });
+    }
+    if (operation == "alpha_blend")
+    {
+        return measure(minSeconds, [&]() { image.alpha_blend(0.5, other, policy); });
+    }
+    if (operation == "psnr")
+    {
+        return measure(minSeconds, [&]() { sink[0] = image.psnr(other, policy); });
+    }
+    if (operation == "colormap" || operation == "colormap16")
+    {
+        // a field like the cell ages of a game_of_life board, taken from the green channel
+        std::vector<float> field(static_cast<size_t>(source.width()) * source.height());
+        for (unsigned int y = 0; y < source.height(); ++y)
+        {
+            for (unsigned int x = 0; x < source.width(); ++x)
+            {
+                unsigned char red, green, blue;
+                image.get_pixel(x, y, red, green, blue);
+                field[static_cast<size_t>(y) * source.width() + x] = green;
+            }
+        }
+
+        if (operation == "colormap")
+        {
+            return measure(minSeconds, [&]() { image.apply_colormap(field.data(), 0.0f, 255.0f, jet_colormap, 1000, policy); });
+        }
+
+        const std::vector<uint16_t> ages(field.begin(), field.end());
+        return measure(minSeconds, [&]() { image.apply_colormap(ages.data(), 0, 255, jet_colormap, 1000, policy); });
+    }
+    return measure(minSeconds, [&]() { image.histogram(bitmap_image::green_plane, sink, policy); });
+}
+
+int main(int argc, char* argv[])
+{
+    BenchmarkParameter cmd(argc, argv);
+
+    std::ofstream file;
+    if (!cmd.openOutput(file))
+    {
+        return -1;
+    }
+    std::ostream &csv = cmd.outputFilename.empty() ? std::cout : file;
+
+    csv << "operation,policy,threads,width,height,iterations,seconds,megapixels_per_second,speedup" << std::endl;
+
+    const CounterRng rng(cmd.seed);
+    const unsigned int threads = std::max(1u, std::thread::hardware_concurrency());
+
+    for (size_t s = 0; s < cmd.widths.size(); ++s)
+    {
+        bitmap_image source(cmd.widths[s], cmd.heights[s]);
+        bitmap_image other(cmd.widths[s], cmd.heights[s]);
+        fillNoise(source, rng, CounterRng::SEEDING);
+        fillNoise(other, rng, CounterRng::INVASION);
+
+        for (const std::string &operation : cmd.operations)
+        {
+            double sequentialSeconds = 0.0; // per iteration, 0 until measured
+
+            for (size_t p = 0; p < cmd.policies.size(); ++p)
+            {
+                const bitmap_image::execution_policy policy = cmd.policies[p];
+                const Timing m = benchmark(operation, policy, source, other, cmd.minSeconds);
+
+                const double perIteration = m.seconds / m.iterations;
+                const double pixels = double(source.width()) * source.height() * m.iterations;
+
+                if (policy == bitmap_image::sequential_execution)
+                {
+                    sequentialSeconds = perIteration;
+                }
+
+                csv << operation << ","
+                    << cmd.policyNames[p] << ","
+                    << ((policy & bitmap_image::parallel_execution) ? threads : 1) << ","
+                    << source.width() << ","
+                    << source.height() << ","
+                    << m.iterations << ","
+                    << m.seconds << ","
+                    << pixels / m.seconds / 1e6 << ",";
+                if (sequentialSeconds > 0)
+                {
+                    csv << sequentialSeconds / perIteration;
+                }
+                csv << std::endl;
+            }
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,117 @@
+#ifndef INCLUDE_CONTENT_HASH_HPP
+#define INCLUDE_CONTENT_HASH_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <utility>
+
+// 128 bit hash of a byte stream in two independent 64 bit lanes (after MurmurHash3), fast
+// enough that reading the data stays the bottleneck. It is not cryptographic: equal hashes
+// are safe to take as equal content for accidental collisions, not for crafted ones.
+class ContentHash
+{
+public:
+    typedef std::pair<uint64_t, uint64_t> Digest;
+
+    ContentHash()
+        : low_(0x9E3779B97F4A7C15ULL)
+        , high_(0xC2B2AE3D27D4EB4FULL)
+        , length_(0)
+        , pending_(0)
+    {
+    }
+
+    void update(const void* data, size_t size)
+    {
+        const unsigned char* bytes = static_cast<const unsigned char*>(data);
+        length_ += size;
+
+        // complete the word left over from the last update first
+        while (pending_ > 0 && pending_ < 8 && size > 0)
+        {
+            tail_[pending_++] = *bytes++;
+            --size;
+        }
+        if (pending_ == 8)
+        {
+            mixWord(load(tail_));
+            pending_ = 0;
+        }
+
+        for (; size >= 8; bytes += 8, size -= 8)
+        {
+            mixWord(load(bytes));
+        }
+
+        memcpy(tail_ + pending_, bytes, size);
+        pending_ += size;
+    }
+
+    Digest finish() const
+    {
+        uint64_t low = low_;
+        uint64_t high = high_;
+
+        if (pending_ > 0)
+        {
+            unsigned char last[8] = { 0 };
+            memcpy(last, tail_, pending_);
+            mix(low, high, load(last));
+        }
+
+        low ^= length_;
+        high ^= length_;
+        low += high;
+        high += low;
+        low = finalize(low);
+        high = finalize(high);
+        low += high;
+        high += low;
+        return Digest(low, high);
+    }
+
+protected:
+    static uint64_t load(const unsigned char* bytes)
+    {
+        uint64_t word;
+        memcpy(&word, bytes, sizeof(word));
+        return word;
+    }
+
+    static uint64_t rotate(uint64_t value, int bits)
+    {
+        return (value << bits) | (value >> (64 - bits));
+    }
+
+    static uint64_t finalize(uint64_t value)
+    {
+        value ^= value >> 33;
+        value *= 0xFF51AFD7ED558CCDULL;
+        value ^= value >> 33;
+        value *= 0xC4CEB9FE1A85EC53ULL;
+        value ^= value >> 33;
+        return value;
+    }
+
+    static void mix(uint64_t &low, uint64_t &high, uint64_t word)
+    {
+        low ^= rotate(word * 0x87C37B91114253D5ULL, 31) * 0x4CF5AD432745937FULL;
+        low = rotate(low, 27) * 5 + 0x52DCE729;
+
+        high ^= rotate(word * 0x4CF5AD432745937FULL, 33) * 0x87C37B91114253D5ULL;
+        high = rotate(high, 31) * 5 + 0x38495AB5;
+    }
+
+    void mixWord(uint64_t word)
+    {
+        mix(low_, high_, word);
+    }
+
+    uint64_t low_;
+    uint64_t high_;
+    uint64_t length_;
+    unsigned char tail_[8];
+    size_t pending_;
+};
+
+#endif
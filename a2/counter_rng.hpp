@@ -0,0 +1,126 @@
+#ifndef INCLUDE_COUNTER_RNG_HPP
+#define INCLUDE_COUNTER_RNG_HPP
+
+#include <cmath>
+#include <cstdint>
+
+// Counter-based random number generator (Philox4x32-10, Salmon et al. 2011). Every
+// output is a pure function of seed and counter, so any thread can generate the
+// random bits of any cell in any order and a run is reproducible from its seed.
+class CounterRng
+{
+public:
+    // the streams keep the bits drawn for different purposes independent
+    enum Stream {
+        SEEDING = 0,
+        INVASION = 1
+    };
+
+    explicit CounterRng(uint64_t seed)
+        : key0_(static_cast<uint32_t>(seed))
+        , key1_(static_cast<uint32_t>(seed >> 32))
+    {
+    }
+
+    // 128 random bits for the counter (c0, c1, c2, c3)
+    void generate(uint32_t c0, uint32_t c1, uint32_t c2, uint32_t c3, uint32_t out[4]) const
+    {
+        uint32_t k0 = key0_;
+        uint32_t k1 = key1_;
+
+        for (int round = 0; round < 10; ++round) {
+            const uint64_t product0 = uint64_t(0xD2511F53) * c0;
+            const uint64_t product1 = uint64_t(0xCD9E8D57) * c2;
+
+            const uint32_t next0 = static_cast<uint32_t>(product1 >> 32) ^ c1 ^ k0;
+            const uint32_t next2 = static_cast<uint32_t>(product0 >> 32) ^ c3 ^ k1;
+            c1 = static_cast<uint32_t>(product1);
+            c3 = static_cast<uint32_t>(product0);
+            c0 = next0;
+            c2 = next2;
+
+            k0 += 0x9E3779B9;
+            k1 += 0xBB67AE85;
+        }
+
+        out[0] = c0;
+        out[1] = c1;
+        out[2] = c2;
+        out[3] = c3;
+    }
+
+    // 64 random bits for the word of a row in the given generation and stream
+    void randomWords(Stream stream, uint32_t generation, uint32_t row, uint32_t word, int count, uint64_t* words) const
+    {
+        for (int i = 0; i < count; i += 2) {
+            uint32_t out[4];
+            generate(word, row, generation, (static_cast<uint32_t>(stream) << 24) | static_cast<uint32_t>(i / 2), out);
+            words[i] = (uint64_t(out[1]) << 32) | out[0];
+            if (i + 1 < count) {
+                words[i + 1] = (uint64_t(out[3]) << 32) | out[2];
+            }
+        }
+    }
+
+private:
+    uint32_t key0_;
+    uint32_t key1_;
+};
+
+// Draws 64 cells at once, each set with a fixed probability. The probability is split
+// into its binary digits 0.b1 b2 ... bn and combined from n random words, starting at
+// the last digit: x = b ? (x | r) : (x & r). Every bit of x ends up set with
+// probability 0.b1 b2 ... bn, using only n words of random bits for 64 cells.
+class RandomMask
+{
+public:
+    static const int MAX_DIGITS = 24;
+
+    explicit RandomMask(double probability)
+        : digits_(0)
+        , bits_(0)
+    {
+        if (probability >= 1.0) {
+            digits_ = -1; // every bit set
+            return;
+        }
+        if (probability <= 0.0) {
+            return;
+        }
+
+        bits_ = static_cast<uint32_t>(std::floor(probability * (1 << MAX_DIGITS) + 0.5));
+        digits_ = MAX_DIGITS;
+        while (digits_ > 0 && !(bits_ & 1)) {
+            bits_ >>= 1;
+            --digits_;
+        }
+    }
+
+    bool isEmpty() const { return digits_ == 0; }
+
+    uint64_t draw(const CounterRng &rng, CounterRng::Stream stream, uint32_t generation, uint32_t row, uint32_t word) const
+    {
+        if (digits_ < 0) {
+            return ~uint64_t(0);
+        }
+        if (digits_ == 0) {
+            return 0;
+        }
+
+        uint64_t random[MAX_DIGITS];
+        rng.randomWords(stream, generation, row, word, digits_, random);
+
+        uint64_t mask = 0;
+        for (int i = 0; i < digits_; ++i) {
+            // bits_ holds the digits b1..bn with bn in the lowest bit
+            mask = ((bits_ >> i) & 1) ? (mask | random[i]) : (mask & random[i]);
+        }
+        return mask;
+    }
+
+private:
+    int digits_;
+    uint32_t bits_;
+};
+
+#endif
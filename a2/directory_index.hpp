@@ -0,0 +1,249 @@
+#ifndef INCLUDE_DIRECTORY_INDEX_HPP
+#define INCLUDE_DIRECTORY_INDEX_HPP
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <sys/stat.h>
+
+// Sizes, modification times and inodes of every file of a walked tree, so that the next
+// walk of the same tree can take over directories that did not change instead of reading
+// them. A directory changes its modification time whenever an entry is added, removed or
+// renamed. Files that are rewritten in place leave their directory unchanged though, so
+// the files of a directory that is taken over still have to be stat'ed.
+//
+// The index is a text file with one directory per line followed by its files,
+//
+//   D <modified> <inode> <path>
+//   F <size> <modified> <inode> <name>
+//
+// separated by tabs, with tabs, newlines and backslashes in names escaped.
+class DirectoryIndex
+{
+public:
+    struct File
+    {
+        File() : size(0), modified(0), inode(0) {}
+        File(const std::string &n, const struct stat &info)
+            : name(n), size(info.st_size), modified(modificationTime(info)), inode(info.st_ino) {}
+
+        bool matches(const struct stat &info) const
+        {
+            return size == info.st_size && modified == modificationTime(info) && inode == info.st_ino;
+        }
+
+        std::string name;
+        long long size;
+        long long modified;       // nanoseconds since the epoch
+        unsigned long long inode;
+    };
+
+    struct Directory
+    {
+        Directory() : modified(UNRELIABLE), inode(0) {}
+
+        // true if the directory has not changed since it was indexed
+        bool matches(const struct stat &info) const
+        {
+            return modified != UNRELIABLE && modified == modificationTime(info) && inode == info.st_ino;
+        }
+
+        long long modified;       // nanoseconds since the epoch
+        unsigned long long inode;
+        std::vector<File> files;
+        std::vector<std::string> subdirectories;
+    };
+
+    // modification time of directories that have to be read again on the next walk
+    static const long long UNRELIABLE = -1;
+
+    static long long modificationTime(const struct stat &info)
+    {
+#if defined __linux__
+        return info.st_mtim.tv_sec * 1000000000LL + info.st_mtim.tv_nsec;
+#else
+        return info.st_mtime * 1000000000LL;
+#endif
+    }
+
+    // Records a directory as it is now. Directories modified within the second before
+    // the walk started could change again without a new modification time, they are
+    // read again next time.
+    Directory& add(const std::string &path, const struct stat &info, long long walkStarted)
+    {
+        Directory &directory = directories_[path];
+        directory.modified = modificationTime(info);
+        directory.inode = info.st_ino;
+        if (directory.modified >= walkStarted - 1000000000LL)
+        {
+            directory.modified = UNRELIABLE;
+        }
+        return directory;
+    }
+
+    // Records a directory that could not be read, so it is tried again next time
+    void addFailed(const std::string &path)
+    {
+        directories_[path] = Directory();
+    }
+
+    // Takes over the directories of an index of another part of the same tree
+    void merge(DirectoryIndex &other)
+    {
+        for (auto &entry : other.directories_)
+        {
+            std::swap(directories_[entry.first], entry.second);
+        }
+        other.directories_.clear();
+    }
+
+    // nullptr if the directory is not indexed
+    const Directory* find(const std::string &path) const
+    {
+        const auto it = directories_.find(path);
+        return it != directories_.end() ? &it->second : nullptr;
+    }
+
+    // nullptr if the file is not indexed, the files of a loaded index are sorted by name
+    static const File* findFile(const Directory &directory, const std::string &name)
+    {
+        const auto it = std::lower_bound(directory.files.begin(), directory.files.end(), name,
+            [](const File &file, const std::string &n) { return file.name < n; });
+        return (it != directory.files.end() && it->name == name) ? &*it : nullptr;
+    }
+
+    // Reads the index of the tree below root, false if there is none
+    bool load(const std::string &filename, const std::string &root)
+    {
+        directories_.clear();
+
+        std::ifstream file(filename);
+        std::string line;
+        if (!std::getline(file, line) || line != header(root))
+        {
+            return false;
+        }
+
+        Directory* directory = nullptr;
+        while (std::getline(file, line))
+        {
+            std::istringstream fields(line);
+            std::string type, name;
+            std::getline(fields, type, '\t');
+
+            if (type == "D")
+            {
+                Directory current;
+                fields >> current.modified >> current.inode;
+                fields.ignore(1);
+                std::getline(fields, name);
+                directory = &directories_[unescape(name)];
+                *directory = current;
+            }
+            else if (type == "F" && directory)
+            {
+                File current;
+                fields >> current.size >> current.modified >> current.inode;
+                fields.ignore(1);
+                std::getline(fields, name);
+                current.name = unescape(name);
+                directory->files.push_back(current);
+            }
+        }
+
+        for (auto &entry : directories_)
+        {
+            std::sort(entry.second.files.begin(), entry.second.files.end(),
+                [](const File &a, const File &b) { return a.name < b.name; });
+
+            // subdirectories are not stored, every directory knows its parent
+            const size_t separator = entry.first.rfind('/');
+            if (entry.first != root && separator != std::string::npos)
+            {
+                const auto parent = directories_.find(entry.first.substr(0, separator));
+                if (parent != directories_.end())
+                {
+                    parent->second.subdirectories.push_back(entry.first.substr(separator + 1));
+                }
+            }
+        }
+        return true;
+    }
+
+    // Writes the index to a temporary file first, so an interrupted run keeps the old one
+    bool save(const std::string &filename, const std::string &root) const
+    {
+        const std::string temporary = filename + ".tmp";
+        {
+            std::ofstream file(temporary);
+            file << header(root) << '\n';
+
+            for (const auto &entry : directories_)
+            {
+                const Directory &directory = entry.second;
+                file << "D\t" << directory.modified << '\t' << directory.inode << '\t'
+                     << escape(entry.first) << '\n';
+
+                for (const File &f : directory.files)
+                {
+                    file << "F\t" << f.size << '\t' << f.modified << '\t' << f.inode << '\t'
+                         << escape(f.name) << '\n';
+                }
+            }
+
+            if (!file.flush())
+            {
+                return false;
+            }
+        }
+        return !std::rename(temporary.c_str(), filename.c_str());
+    }
+
+protected:
+    static std::string header(const std::string &root)
+    {
+        return "dirinfo index 1\t" + escape(root);
+    }
+
+    static std::string escape(const std::string &text)
+    {
+        std::string escaped;
+        for (char c : text)
+        {
+            switch (c)
+            {
+            case '\\': escaped += "\\\\"; break;
+            case '\t': escaped += "\\t"; break;
+            case '\n': escaped += "\\n"; break;
+            default: escaped += c;
+            }
+        }
+        return escaped;
+    }
+
+    static std::string unescape(const std::string &text)
+    {
+        std::string unescaped;
+        for (size_t i = 0; i < text.size(); ++i)
+        {
+            if (text[i] == '\\' && i + 1 < text.size())
+            {
+                ++i;
+                unescaped += (text[i] == 't') ? '\t' : (text[i] == 'n') ? '\n' : text[i];
+            }
+            else
+            {
+                unescaped += text[i];
+            }
+        }
+        return unescaped;
+    }
+
+    std::unordered_map<std::string, Directory> directories_;
+};
+
+#endif
@@ -0,0 +1,301 @@
+#ifndef INCLUDE_DIRECTORY_WALKER_HPP
+#define INCLUDE_DIRECTORY_WALKER_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+// Walks a directory tree with a fixed number of threads. Every thread keeps its own
+// queue of directories still to be read and works on the newest one, idle threads
+// steal the oldest directory of another queue, which is usually the largest subtree.
+// Entries are opened and stat'ed relative to the descriptor of their directory, so
+// the kernel does not resolve the full path again for every file. Threads that find no
+// directory to read sleep until another thread queues one.
+class DirectoryWalker
+{
+public:
+    // Called for every entry that is not a directory, concurrently from all threads.
+    // worker is in [0, size()), info is zeroed if the entry could not be stat'ed.
+    typedef std::function<void(int worker, const std::string &directory, const std::string &name,
+                               const struct stat &info)> FileVisitor;
+
+    // Called for every directory once it is open. It may fill in the names of the
+    // subdirectories and return true to skip reading the directory, e.g. because it did
+    // not change since an earlier walk. It then reports the files of the directory itself
+    // and can stat them relative to the descriptor of the directory.
+    typedef std::function<bool(int worker, const std::string &path, int descriptor, const struct stat &info,
+                               std::vector<std::string> &subdirectories)> DirectoryVisitor;
+
+    explicit DirectoryWalker(int threads)
+        : threads_(std::max(1, threads))
+        , pending_(0)
+        , queued_(0)
+        , idle_(0)
+    {
+    }
+
+    DirectoryWalker(const DirectoryWalker&) = delete;
+    DirectoryWalker& operator=(const DirectoryWalker&) = delete;
+
+    // number of threads including the calling one
+    int size() const
+    {
+        return threads_;
+    }
+
+    // Visits every file below root and returns once all threads are done
+    void walk(const std::string &root, const FileVisitor &visitor,
+              const DirectoryVisitor &directoryVisitor = DirectoryVisitor())
+    {
+        queues_.clear();
+        failures_.clear();
+        for (int i = 0; i < threads_; ++i)
+        {
+            queues_.push_back(std::unique_ptr<Queue>(new Queue()));
+            failures_.push_back(std::vector<std::string>());
+        }
+
+        push(0, Task(nullptr, root));
+
+        std::vector<std::thread> workers;
+        for (int i = 1; i < threads_; ++i)
+        {
+            workers.push_back(std::thread(&DirectoryWalker::work, this, i, std::cref(visitor),
+                                          std::cref(directoryVisitor)));
+        }
+
+        work(0, visitor, directoryVisitor);
+
+        for (auto &worker : workers)
+        {
+            worker.join();
+        }
+    }
+
+    // directories of the last walk that could not be opened
+    std::vector<std::string> failedDirectories() const
+    {
+        std::vector<std::string> failed;
+        for (const std::vector<std::string> &paths : failures_)
+        {
+            failed.insert(failed.end(), paths.begin(), paths.end());
+        }
+        return failed;
+    }
+
+protected:
+    // An open directory, kept alive until all of its subdirectories have been opened
+    struct Directory
+    {
+        Directory(DIR* s, const std::string &p) : stream(s), path(p) {}
+        ~Directory() { closedir(stream); }
+
+        DIR* stream;
+        std::string path;
+    };
+
+    // A subdirectory still to be read, the root has no parent and its path as name
+    struct Task
+    {
+        Task() {}
+        Task(const std::shared_ptr<Directory> &p, const std::string &n) : parent(p), name(n) {}
+
+        std::shared_ptr<Directory> parent;
+        std::string name;
+    };
+
+    struct Queue
+    {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    void push(int worker, const Task &task)
+    {
+        // counted before it is visible, so no thread can see an empty tree too early
+        ++pending_;
+        {
+            std::lock_guard<std::mutex> lock(queues_[worker]->mutex);
+            queues_[worker]->tasks.push_back(task);
+        }
+        ++queued_;
+
+        if (idle_ > 0)
+        {
+            // taking the lock ensures the sleeping thread is already waiting
+            std::lock_guard<std::mutex> lock(idleMutex_);
+            wake_.notify_one();
+        }
+    }
+
+    bool pop(int worker, Task &task)
+    {
+        Queue &queue = *queues_[worker];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.tasks.empty())
+        {
+            return false;
+        }
+        task = queue.tasks.back();
+        queue.tasks.pop_back();
+        --queued_;
+        return true;
+    }
+
+    bool steal(int victim, Task &task)
+    {
+        Queue &queue = *queues_[victim];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.tasks.empty())
+        {
+            return false;
+        }
+        task = queue.tasks.front();
+        queue.tasks.pop_front();
+        --queued_;
+        return true;
+    }
+
+    // Takes the next directory of this thread or of any other one, false once the
+    // whole tree is done
+    bool next(int worker, Task &task)
+    {
+        for (;;)
+        {
+            if (pop(worker, task))
+            {
+                return true;
+            }
+            for (int i = 1; i < threads_; ++i)
+            {
+                if (steal((worker + i) % threads_, task))
+                {
+                    return true;
+                }
+            }
+            if (pending_ == 0)
+            {
+                return false;
+            }
+
+            // a directory is still being read, wait until it queues another one or the
+            // tree is done
+            std::unique_lock<std::mutex> lock(idleMutex_);
+            ++idle_;
+            wake_.wait(lock, [this]() { return queued_ > 0 || pending_ == 0; });
+            --idle_;
+        }
+    }
+
+    void work(int worker, const FileVisitor &visitor, const DirectoryVisitor &directoryVisitor)
+    {
+        Task task;
+        while (next(worker, task))
+        {
+            visit(worker, task, visitor, directoryVisitor);
+            task = Task();
+            if (--pending_ == 0)
+            {
+                std::lock_guard<std::mutex> lock(idleMutex_);
+                wake_.notify_all();
+            }
+        }
+    }
+
+    void visit(int worker, const Task &task, const FileVisitor &visitor, const DirectoryVisitor &directoryVisitor)
+    {
+        const int flags = O_RDONLY | O_DIRECTORY | O_CLOEXEC;
+        const int fd = task.parent ? openat(dirfd(task.parent->stream), task.name.c_str(), flags)
+                                   : open(task.name.c_str(), flags);
+        const std::string path = task.parent ? task.parent->path + '/' + task.name : task.name;
+
+        DIR* stream = (fd >= 0) ? fdopendir(fd) : nullptr;
+        if (stream == nullptr)
+        {
+            if (fd >= 0)
+            {
+                close(fd);
+            }
+            failures_[worker].push_back(path);
+            return;
+        }
+
+        std::shared_ptr<Directory> directory(new Directory(stream, path));
+        const int descriptor = dirfd(stream);
+
+        if (directoryVisitor)
+        {
+            struct stat info;
+            std::vector<std::string> subdirectories;
+
+            if (!fstat(descriptor, &info) && directoryVisitor(worker, path, descriptor, info, subdirectories))
+            {
+                for (const std::string &name : subdirectories)
+                {
+                    push(worker, Task(directory, name));
+                }
+                return;
+            }
+        }
+
+        struct dirent* ent;
+        while ((ent = readdir(stream)) != nullptr)
+        {
+            const char* name = ent->d_name;
+            if (!strcmp(name, ".") || !strcmp(name, ".."))
+            {
+                // Stay within folder hierarchy
+                continue;
+            }
+
+            struct stat info;
+            bool isDirectory = ent->d_type == DT_DIR;
+            bool hasInfo = false;
+
+            if (ent->d_type == DT_UNKNOWN)
+            {
+                // some network filesystems do not fill in d_type
+                hasInfo = !fstatat(descriptor, name, &info, AT_SYMLINK_NOFOLLOW);
+                isDirectory = hasInfo && S_ISDIR(info.st_mode);
+                hasInfo = hasInfo && !S_ISLNK(info.st_mode);
+            }
+
+            if (isDirectory)
+            {
+                push(worker, Task(directory, name));
+                continue;
+            }
+
+            // symbolic links count with the size of their target
+            if (!hasInfo && fstatat(descriptor, name, &info, 0))
+            {
+                memset(&info, 0, sizeof(info));
+            }
+            visitor(worker, path, name, info);
+        }
+    }
+
+    const int threads_;
+    std::vector<std::unique_ptr<Queue>> queues_;
+    std::vector<std::vector<std::string>> failures_;
+    std::atomic<int> pending_;     // directories queued or being read
+    std::atomic<int> queued_;      // directories queued
+    std::atomic<int> idle_;        // threads waiting for a directory
+    std::mutex idleMutex_;
+    std::condition_variable wake_;
+};
+
+#endif
@@ -4,7 +4,20 @@
 #include <algorithm>
 #include <string>
 #include <map>
-#include <list>
+#include <unordered_map>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <cstdlib>
+#include <chrono>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "content_hash.hpp"
+#include "directory_index.hpp"
+#include "directory_walker.hpp"
+#include "thread_pool.hpp"
 
 #if defined _WIN32
 #include <direct.h>
@@ -14,36 +27,57 @@
 #include <unistd.h>
 #endif
 
+#if defined __linux__
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#endif
+
 using namespace std;
 
+const size_t UNLIMITED_PATHS = numeric_limits<size_t>::max();
+
 typedef struct CSVConfig {
 	bool fsize;
 	bool fnum;
 	bool files;
-	CSVConfig():fsize(), fnum(), files() { }
+	bool directories;
+	size_t maxPaths;
+	CSVConfig():fsize(), fnum(), files(), directories(), maxPaths(UNLIMITED_PATHS) { }
 } CSVConfig;
 
-typedef struct CategoryInfo {
-	string name;
-	unsigned int files;
-	unsigned int memory;
-	string paths;
-	CategoryInfo(string n, unsigned int f, unsigned int m, string p) : name(n), files(f), memory(m), paths(p) {}
-} CategoryInfo;
+// Directory of a file entry, shared by the files of a directory and freed with the last one
+typedef std::shared_ptr<const string> SharedPath;
 
 typedef struct FileEntry {
 	string name;
-	string path;
-	unsigned int size;
-	FileEntry(string n, string p, unsigned int s) : name(n), path(p), size(s) {}
+	SharedPath path;
+	unsigned long long size;
+	bool unchanged;	// same as in the index of the last run
+	FileEntry(const string& n, const SharedPath& p, unsigned long long s, bool u) : name(n), path(p), size(s), unchanged(u) {}
 } FileEntry;
 
-typedef std::list<FileEntry*> FileEntryList;
-typedef std::map<string,FileEntryList> DirectoryMap;
+// Files of one extension, the entries are only kept if their paths are needed
+typedef struct ExtensionInfo {
+	unsigned int files;
+	unsigned long long memory;
+	vector<FileEntry> entries;
+	ExtensionInfo() : files(), memory() { }
+} ExtensionInfo;
+
+typedef std::vector<FileEntry> FileEntryList;
+typedef std::map<string,ExtensionInfo> DirectoryMap;
+
+// Map from directories to the extensions of all files below them, without entries
+typedef std::unordered_map<string,DirectoryMap> DirectoryRollup;
 
 // Map from extensions to file entries
 DirectoryMap dirinfo;
 
+// Map from directories to their totals, if rolled up
+DirectoryRollup dirrollup;
+
 // Map from flattened filenames to number of files
 map<string,int> flattenedMap;
 
@@ -94,57 +128,140 @@ void renameDuplicateFile(string& filename, const int& version)
     filename.insert(pos, to_string(version));
 }
 
-CategoryInfo* collectEntries(const string& name, const FileEntryList& fileEntries)
-{
-	unsigned int memory = 0;
-	unsigned int files = 0;
-	string paths = "[";
+// Collects the CSV text in a fixed buffer and hands it to the stream in large blocks,
+// so neither a row nor the list of paths is ever assembled as a whole
+class CSVSink {
+public:
+	CSVSink(ostream& out) : out(out), used(0) { }
+	~CSVSink() { flush(); }
 
-	FileEntryList::const_iterator fileEntry;
-	for (fileEntry = fileEntries.begin(); fileEntry != fileEntries.end(); ++fileEntry) {
-		paths += "\"" + (*fileEntry)->path + PATH_SEPERATOR + (*fileEntry)->name + "\",";
-		memory += (*fileEntry)->size;
-		files++;
+	CSVSink& operator<<(const string& text) {
+		write(text.data(), text.size());
+		return *this;
 	}
 
-	paths.erase(paths.end()-1);
-	paths += "]";
+	CSVSink& operator<<(const char* text) {
+		write(text, strlen(text));
+		return *this;
+	}
+
+	CSVSink& operator<<(char c) {
+		write(&c, 1);
+		return *this;
+	}
+
+	CSVSink& operator<<(unsigned int value) {
+		char digits[16];
+		write(digits, snprintf(digits, sizeof(digits), "%u", value));
+		return *this;
+	}
+
+	CSVSink& operator<<(unsigned long long value) {
+		char digits[24];
+		write(digits, snprintf(digits, sizeof(digits), "%llu", value));
+		return *this;
+	}
+
+	void write(const char* data, size_t size) {
+		if (used + size > sizeof(buffer)) {
+			flush();
+			if (size > sizeof(buffer)) {
+				out.write(data, size);
+				return;
+			}
+		}
+		memcpy(buffer + used, data, size);
+		used += size;
+	}
+
+	void flush() {
+		out.write(buffer, used);
+		used = 0;
+	}
+
+private:
+	ostream& out;
+	char buffer[64 * 1024];
+	size_t used;
+};
+
+// One row per directory and extension, with the files of all subdirectories included
+void printDirectoryCSV(const DirectoryRollup& r, const CSVConfig& config, ostream &out) {
+    CSVSink sink(out);
 
-	return new CategoryInfo(name, files, memory, paths);
+    sink << "directory,extension";
+    if (config.fsize) {
+    	sink << ",memory";
+    }
+    if (config.fnum) {
+    	sink << ",number";
+    }
+    sink << '\n';
+
+    vector<const DirectoryRollup::value_type*> directories;
+    for (DirectoryRollup::const_iterator it = r.begin(); it != r.end(); ++it) {
+    	directories.push_back(&*it);
+    }
+    sort(directories.begin(), directories.end(),
+         [](const DirectoryRollup::value_type* a, const DirectoryRollup::value_type* b) { return a->first < b->first; });
+
+    for (const DirectoryRollup::value_type* directory : directories) {
+    	DirectoryMap::const_iterator it;
+    	for (it = directory->second.begin(); it != directory->second.end(); ++it) {
+    		sink << '"' << directory->first << "\"," << it->first;
+    		if (config.fsize) {
+    			sink << ',' << it->second.memory;
+    		}
+    		if (config.fnum) {
+    			sink << ',' << it->second.files;
+    		}
+    		sink << '\n';
+    	}
+    }
 }
 
 void printCSV(const DirectoryMap& m, const CSVConfig& config, ostream &out) {
-    out << "extension";
+    if (config.directories) {
+    	printDirectoryCSV(dirrollup, config, out);
+    	return;
+    }
+
+    CSVSink sink(out);
+
+    sink << "extension";
     if (config.fsize) {
-    	out << ",memory";
+    	sink << ",memory";
     }
     if (config.fnum) {
-    	out << ",number";
+    	sink << ",number";
     }
     if (config.files) {
-    	out << ",files";
+    	sink << ",files";
     }
-    out << endl;
+    sink << '\n';
 
-    // Print individual categories
+    // Print individual categories, row by row
     DirectoryMap::const_iterator it;
     for (it = m.begin(); it != m.end(); ++it) {
 
-    	string extension = it->first;
-    	FileEntryList entryList = it->second;
-    	CategoryInfo* categoryInfo = collectEntries(extension, entryList);
-
-    	out << categoryInfo->name;
+    	sink << it->first;
     	if (config.fsize) {
-	    	out << "," << categoryInfo->memory;
+	    	sink << ',' << it->second.memory;
 	    }
 	    if (config.fnum) {
-	    	out << "," << categoryInfo->files;
+	    	sink << ',' << it->second.files;
 	    }
 	    if (config.files) {
-	    	out << "," << categoryInfo->paths;
+	    	const size_t paths = min(config.maxPaths, it->second.entries.size());
+
+	    	sink << ",[";
+	    	for (size_t i = 0; i < paths; ++i) {
+	    		const FileEntry& fileEntry = it->second.entries[i];
+	    		sink << (i ? ",\"" : "\"") << *fileEntry.path << PATH_SEPERATOR << fileEntry.name << '"';
+	    	}
+	    	sink << ']';
 	    }
-	    out << endl;
+	    sink << '\n';
     }
 }
 
@@ -159,77 +276,571 @@ void printCSVToFile(const DirectoryMap& m, const CSVConfig& config, string filen
     }
 }
 
-void traverseDirectory(string path, string flattenDir = "")
+// Name of the file in the flattened directory, numbered if the name is already taken
+string flattenedPath(const string& fullpath, const string& flattenDir)
+{
+	string flattenedName = fullpath;
+	std::replace(flattenedName.begin(), flattenedName.end(), PATH_SEPERATOR, UNDERSCORE);
+
+	map<string,int>::iterator iter = flattenedMap.find(flattenedName);
+	int numFiles = 0;
+
+	if (iter != flattenedMap.end())
+	{
+		numFiles += iter->second;
+	}
+	flattenedMap[flattenedName] = ++numFiles;
+
+	if (numFiles > 1) {
+		renameDuplicateFile(flattenedName, numFiles);
+	}
+
+	return flattenDir + PATH_SEPERATOR + flattenedName;
+}
+
+#if defined __linux__
+// Copies the rest of in to out, from the current offsets of both. Every step falls back
+// to the next one if the kernel or the filesystems do not support it for these files.
+bool copyRemainder(int in, int out, long long& copied)
+{
+	ssize_t n = 0;
+
+#if defined __GLIBC__ && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 27))
+	while ((n = copy_file_range(in, nullptr, out, nullptr, 1 << 30, 0)) > 0) {
+		copied += n;
+	}
+	if (n == 0) {
+		return true;
+	}
+#endif
+
+	while ((n = sendfile(out, in, nullptr, 1 << 30)) > 0) {
+		copied += n;
+	}
+	if (n == 0) {
+		return true;
+	}
+
+	char buffer[64 * 1024];
+	while ((n = read(in, buffer, sizeof(buffer))) > 0) {
+		for (ssize_t written = 0; written < n; ) {
+			const ssize_t w = write(out, buffer + written, n - written);
+			if (w < 0) {
+				return false;
+			}
+			written += w;
+		}
+		copied += n;
+	}
+	return n == 0;
+}
+#endif
+
+// Copies the file without moving its bytes through userspace where possible, preferring
+// a reflink that shares the blocks of the source. Returns the number of bytes or -1.
+long long copyFile(const string& source, const string& target)
+{
+#if defined __linux__
+	const int in = open(source.c_str(), O_RDONLY | O_CLOEXEC);
+	if (in < 0) {
+		return -1;
+	}
+	const int out = open(target.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+	if (out < 0) {
+		close(in);
+		return -1;
+	}
+
+	struct stat info;
+	long long copied = 0;
+	bool success = !fstat(in, &info);
+
+#if defined FICLONE
+	// files of procfs and the like report a size of 0, they are read instead
+	if (success && info.st_size > 0 && !ioctl(out, FICLONE, in)) {
+		copied = info.st_size;
+	} else
+#endif
+	if (success) {
+		success = copyRemainder(in, out, copied);
+	}
+
+	close(in);
+	success = !close(out) && success;
+	return success ? copied : -1;
+#else
+	std::ifstream infile(source, std::ios_base::binary);
+	std::ofstream outfile(target, std::ios_base::binary);
+	outfile << infile.rdbuf();
+	return outfile ? static_cast<long long>(outfile.tellp()) : -1;
+#endif
+}
+
+typedef struct FileCopy {
+	string source;
+	string target;
+	long long size;
+	bool unchanged;
+	FileCopy(const string& s, const string& t, long long n, bool u) : source(s), target(t), size(n), unchanged(u) {}
+} FileCopy;
+
+// Bytes at the start and at the end of a file that are compared before all of it
+const long long PARTIAL_HASH_BYTES = 4096;
+
+// Hashes the first and the last PARTIAL_HASH_BYTES of the file if partial, all of it otherwise
+bool hashFile(const string& path, bool partial, ContentHash::Digest& digest)
 {
-	DIR *dir;
-	struct dirent *ent;
+	const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		return false;
+	}
 
-	dir = opendir(path.c_str());
+	ContentHash hash;
+	char buffer[64 * 1024];
+	struct stat info;
+	bool success = !fstat(fd, &info);
+
+	if (success && partial && info.st_size > 2 * PARTIAL_HASH_BYTES) {
+		success = pread(fd, buffer, PARTIAL_HASH_BYTES, 0) == PARTIAL_HASH_BYTES
+		       && pread(fd, buffer + PARTIAL_HASH_BYTES, PARTIAL_HASH_BYTES, info.st_size - PARTIAL_HASH_BYTES) == PARTIAL_HASH_BYTES;
+		hash.update(buffer, 2 * PARTIAL_HASH_BYTES);
+	} else if (success) {
+#if defined __linux__
+		posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+		ssize_t n;
+		while ((n = read(fd, buffer, sizeof(buffer))) > 0) {
+			hash.update(buffer, n);
+		}
+		success = n == 0;
+	}
 
-	if (dir != nullptr) {
-		while ((ent = readdir(dir)) != nullptr) {
-			string name = ent->d_name;
-			string fullpath = path + PATH_SEPERATOR + name;
+	close(fd);
+	digest = hash.finish();
+	return success;
+}
 
-			if (name == CURRENT_FOLDER || name == PARENT_FOLDER) {
-				// Stay within folder hierarchy
-				continue;
+// Reads both files side by side, true if they have exactly the same content
+bool equalFiles(const string& first, const string& second)
+{
+	const int fd1 = open(first.c_str(), O_RDONLY | O_CLOEXEC);
+	const int fd2 = fd1 < 0 ? -1 : open(second.c_str(), O_RDONLY | O_CLOEXEC);
+	bool equal = fd1 >= 0 && fd2 >= 0;
+
+	char buffer1[64 * 1024];
+	char buffer2[64 * 1024];
+
+	while (equal) {
+		const ssize_t n = read(fd1, buffer1, sizeof(buffer1));
+		if (n <= 0) {
+			// the second file has to end here as well
+			equal = n == 0 && read(fd2, buffer2, 1) == 0;
+			break;
+		}
+
+		ssize_t filled = 0;
+		while (filled < n) {
+			const ssize_t m = read(fd2, buffer2 + filled, n - filled);
+			if (m <= 0) {
+				break;
 			}
+			filled += m;
+		}
+		equal = filled == n && !memcmp(buffer1, buffer2, n);
+	}
+
+	if (fd1 >= 0) {
+		close(fd1);
+	}
+	if (fd2 >= 0) {
+		close(fd2);
+	}
+	return equal;
+}
+
+// Groups the given copies by size and hash, every copy of a group gets the first one of
+// it as its original once their bytes are compared, the hash alone is no proof. Copies
+// whose file could not be read or that differ after all are left alone.
+void groupByHash(const vector<FileCopy>& copies, const vector<size_t>& candidates, bool partial,
+                 ThreadPool& pool, vector<size_t>& original, vector<size_t>& ambiguous)
+{
+	vector<ContentHash::Digest> digests(candidates.size());
+	vector<char> hashed(candidates.size());
+
+	pool.parallelFor(static_cast<int>(candidates.size()), 1, [&](int begin, int end) {
+		for (int k = begin; k < end; ++k) {
+			hashed[k] = hashFile(copies[candidates[k]].source, partial, digests[k]);
+		}
+	});
+
+	map<pair<long long,ContentHash::Digest>,vector<size_t>> groups;
+	for (size_t k = 0; k < candidates.size(); ++k) {
+		if (hashed[k]) {
+			groups[make_pair(copies[candidates[k]].size, digests[k])].push_back(candidates[k]);
+		}
+	}
+
+	vector<pair<size_t,size_t>> confirm;
+	for (auto it = groups.begin(); it != groups.end(); ++it) {
+		const vector<size_t>& group = it->second;
+		if (group.size() < 2) {
+			continue;
+		}
+		if (partial && it->first.first > 2 * PARTIAL_HASH_BYTES) {
+			// Only the start and the end are known to be equal, all of it has to be compared
+			ambiguous.insert(ambiguous.end(), group.begin(), group.end());
+			continue;
+		}
+		for (size_t k = 1; k < group.size(); ++k) {
+			confirm.push_back(make_pair(group[k], group[0]));
+		}
+	}
+
+	vector<char> equal(confirm.size());
+	pool.parallelFor(static_cast<int>(confirm.size()), 1, [&](int begin, int end) {
+		for (int k = begin; k < end; ++k) {
+			equal[k] = equalFiles(copies[confirm[k].first].source, copies[confirm[k].second].source);
+		}
+	});
+
+	for (size_t k = 0; k < confirm.size(); ++k) {
+		if (equal[k]) {
+			original[confirm[k].first] = confirm[k].second;
+		}
+	}
+}
+
+// Finds the copies of equal content, original[i] is the first copy with the content of
+// copy i. Only files of equal size are compared, by their start and end first and only
+// then as a whole, so most files are not read at all.
+vector<size_t> findDuplicates(const vector<FileCopy>& copies, const vector<char>& pending, ThreadPool& pool)
+{
+	vector<size_t> original(copies.size());
+	for (size_t i = 0; i < copies.size(); ++i) {
+		original[i] = i;
+	}
+
+	map<long long,vector<size_t>> sizes;
+	for (size_t i = 0; i < copies.size(); ++i) {
+		if (pending[i] && copies[i].size > 0) {
+			sizes[copies[i].size].push_back(i);
+		}
+	}
+
+	vector<size_t> candidates;
+	for (auto it = sizes.begin(); it != sizes.end(); ++it) {
+		if (it->second.size() > 1) {
+			candidates.insert(candidates.end(), it->second.begin(), it->second.end());
+		}
+	}
+
+	vector<size_t> ambiguous;
+	groupByHash(copies, candidates, true, pool, original, ambiguous);
+
+	vector<size_t> unused;
+	groupByHash(copies, ambiguous, false, pool, original, unused);
+	return original;
+}
+
+// Copies the files on all threads and reports the throughput. Files that did not change
+// since the last run are skipped if their copy is still there. With dedupe, files of
+// equal content are copied once and the other copies become hard links to it.
+void flattenFiles(const vector<FileCopy>& copies, int threads, bool dedupe)
+{
+	typedef std::chrono::steady_clock Clock;
+
+	ThreadPool pool(threads);
+	const int count = static_cast<int>(copies.size());
+	vector<long long> bytes(copies.size());
+	vector<char> pending(copies.size());
+	const Clock::time_point start = Clock::now();
+
+	pool.parallelFor(count, 1, [&](int begin, int end) {
+		for (int i = begin; i < end; ++i) {
+			struct stat target;
+			pending[i] = !copies[i].unchanged || stat(copies[i].target.c_str(), &target)
+			             || target.st_size != copies[i].size;
+		}
+	});
+
+	vector<size_t> original;
+	if (dedupe) {
+		original = findDuplicates(copies, pending, pool);
+	}
 
-			if (ent->d_type == DT_DIR) {
-				traverseDirectory(fullpath, flattenDir);
-			} else {
-				// Collect data
-				string ext = getFileExtension(name);
-				struct stat fileinfo;
-				unsigned int size = 0;
-				if (!stat(fullpath.c_str(), &fileinfo))
-				{
-					size = fileinfo.st_size;
+	// Originals first, so every link has its target
+	for (int pass = 0; pass < (dedupe ? 2 : 1); ++pass) {
+		pool.parallelFor(count, 1, [&](int begin, int end) {
+			for (int i = begin; i < end; ++i) {
+				const bool isLink = dedupe && original[i] != static_cast<size_t>(i);
+				if (!pending[i] || isLink != (pass == 1)) {
+					continue;
 				}
 
-				// Create new list of entries if necessary
-				FileEntryList fileEntries;
-				FileEntry *entry = new FileEntry(name, path, size);
-				DirectoryMap::iterator it = dirinfo.find(ext);
+				// The old copy may be a hard link to another one, which must not be overwritten
+				unlink(copies[i].target.c_str());
 
-				if (it != dirinfo.end())
-				{
-					fileEntries = it->second;
+				if (isLink && bytes[original[i]] >= 0 && !link(copies[original[i]].target.c_str(), copies[i].target.c_str())) {
+					bytes[i] = 0;
+				} else {
+					bytes[i] = copyFile(copies[i].source, copies[i].target);
 				}
-				fileEntries.push_back(entry);
-
-				// Map list to file extension
-				dirinfo[ext] = fileEntries;
-
-                // Flatten hierarchy
-                if (!flattenDir.empty()) {
-                    string flattenedName = fullpath;
-                    std::replace(flattenedName.begin(), flattenedName.end(), PATH_SEPERATOR, UNDERSCORE);
-
-                    map<string,int>::iterator iter = flattenedMap.find(flattenedName);
-                    int numFiles = 0;
-
-                    if (iter != flattenedMap.end())
-                    {
-                        numFiles += iter->second;
-                    }
-                    flattenedMap[flattenedName] = ++numFiles;
-
-                    if (numFiles > 1) {
-                        renameDuplicateFile(flattenedName, numFiles);
-                    }
-
-                    // Copy file
-                    std::ifstream infile(fullpath, std::ios_base::binary);
-                    std::ofstream outfile(flattenDir + PATH_SEPERATOR + flattenedName, std::ios_base::binary);
-                    outfile << infile.rdbuf();
-                }
 			}
+		});
+	}
+
+	const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+	long long total = 0;
+	long long linked = 0;
+	long long saved = 0;
+	long long skipped = 0;
+
+	for (size_t i = 0; i < copies.size(); ++i) {
+		if (!pending[i]) {
+			skipped++;
+		} else if (bytes[i] < 0) {
+			cerr << "Failed to copy file: " << copies[i].source << endl;
+		} else if (dedupe && original[i] != i && bytes[i] == 0 && copies[i].size > 0) {
+			linked++;
+			saved += copies[i].size;
+		} else {
+			total += bytes[i];
 		}
-		closedir(dir);
+	}
+
+	cerr << "Copied " << total << " bytes in " << seconds << " s ("
+	     << (seconds > 0 ? total / seconds / 1e6 : 0) << " MB/s)";
+	if (linked > 0) {
+		cerr << ", linked " << linked << " duplicates of " << saved << " bytes";
+	}
+	if (skipped > 0) {
+		cerr << ", skipped " << skipped << " unchanged files";
+	}
+	cerr << endl;
+}
+
+bool comparePaths(const string& pathA, const string& nameA, const string& pathB, const string& nameB)
+{
+	return pathA != pathB ? pathA < pathB : nameA < nameB;
+}
+
+bool compareEntries(const FileEntry& a, const FileEntry& b)
+{
+	return comparePaths(*a.path, a.name, *b.path, b.name);
+}
+
+// Counts the file and keeps the first maxEntries entries of its extension in path order.
+// Once that many are kept, they form a heap with the last entry in front, which is
+// replaced whenever a file comes before it.
+void collectEntry(DirectoryMap& m, SharedPath& directory, const string& path, const string& name, unsigned long long size,
+                  size_t maxEntries, bool unchanged)
+{
+	// Append in place, the counts are all that is needed unless paths are exported
+	ExtensionInfo& info = m[getFileExtension(name)];
+	info.files++;
+	info.memory += size;
+
+	FileEntryList& entries = info.entries;
+	const bool isFull = entries.size() >= maxEntries;
+
+	if (isFull && (maxEntries == 0 || !comparePaths(path, name, *entries.front().path, entries.front().name))) {
+		return;
+	}
+
+	// Consecutive files of a thread mostly come from the same directory
+	if (!directory || *directory != path) {
+		directory = make_shared<const string>(path);
+	}
+
+	if (isFull) {
+		pop_heap(entries.begin(), entries.end(), compareEntries);
+		entries.back() = FileEntry(name, directory, size, unchanged);
+		push_heap(entries.begin(), entries.end(), compareEntries);
 	} else {
-		cout << "Failed to read directory: " << path << endl;
+		entries.push_back(FileEntry(name, directory, size, unchanged));
+		if (entries.size() == maxEntries) {
+			make_heap(entries.begin(), entries.end(), compareEntries);
+		}
+	}
+}
+
+// Adds the totals of every directory to those of its parent, deepest directories first,
+// so each directory ends up with all files below it
+void rollupDirectories(DirectoryRollup& r, const string& root)
+{
+	// Directories by their depth below the root
+	vector<vector<string>> depths;
+	for (DirectoryRollup::const_iterator it = r.begin(); it != r.end(); ++it) {
+		const size_t depth = count(it->first.begin() + min(root.size(), it->first.size()), it->first.end(), '/');
+		if (depths.size() <= depth) {
+			depths.resize(depth + 1);
+		}
+		depths[depth].push_back(it->first);
+	}
+
+	for (size_t depth = depths.size(); depth-- > 1; ) {
+		for (const string& directory : depths[depth]) {
+			const string parent = directory.substr(0, directory.rfind('/'));
+			if (!r.count(parent)) {
+				// Directories without files of their own only appear through their children
+				depths[depth - 1].push_back(parent);
+			}
+
+			DirectoryMap& totals = r[parent];
+			const DirectoryMap& own = r[directory];
+			for (DirectoryMap::const_iterator it = own.begin(); it != own.end(); ++it) {
+				totals[it->first].files += it->second.files;
+				totals[it->first].memory += it->second.memory;
+			}
+		}
+	}
+}
+
+void traverseDirectory(string path, int threads, size_t maxEntries, string flattenDir = "", string indexFile = "",
+                       bool dedupe = false, bool rollup = false)
+{
+	DirectoryWalker walker(threads);
+
+	// Every thread collects into its own map, so the walk itself needs no locking
+	vector<DirectoryMap> workerInfo(walker.size());
+	vector<SharedPath> workerDirectory(walker.size());
+
+	// For the rollup, the files of each directory itself are counted during the walk
+	vector<DirectoryRollup> workerRollup(rollup ? walker.size() : 0);
+	vector<DirectoryMap*> workerTotals(walker.size());
+	vector<string> workerTotalsDirectory(walker.size());
+
+	const auto collect = [&](int worker, const string& directory, const string& name, unsigned long long size,
+	                         bool unchanged) {
+		collectEntry(workerInfo[worker], workerDirectory[worker], directory, name, size, maxEntries, unchanged);
+
+		if (rollup) {
+			// A thread reports all files of a directory in a row
+			if (!workerTotals[worker] || workerTotalsDirectory[worker] != directory) {
+				workerTotals[worker] = &workerRollup[worker][directory];
+				workerTotalsDirectory[worker] = directory;
+			}
+			ExtensionInfo& totals = (*workerTotals[worker])[getFileExtension(name)];
+			totals.files++;
+			totals.memory += size;
+		}
+	};
+
+	// With an index, every thread also records the directories it reads for the next run
+	DirectoryIndex previousIndex;
+	const bool isIndexed = !indexFile.empty();
+	const bool hasPreviousIndex = isIndexed && previousIndex.load(indexFile, path);
+	const long long walkStarted = chrono::duration_cast<chrono::nanoseconds>(
+		chrono::system_clock::now().time_since_epoch()).count();
+
+	vector<DirectoryIndex> workerIndex(walker.size());
+	vector<DirectoryIndex::Directory*> workerIndexed(walker.size());
+	vector<const DirectoryIndex::Directory*> workerPrevious(walker.size());
+
+	DirectoryWalker::DirectoryVisitor visitDirectory;
+	if (isIndexed) {
+		visitDirectory = [&](int worker, const string& directory, int descriptor, const struct stat& info,
+		                     vector<string>& subdirectories) {
+			DirectoryIndex::Directory& indexed = workerIndex[worker].add(directory, info, walkStarted);
+			const DirectoryIndex::Directory* previous = hasPreviousIndex ? previousIndex.find(directory) : nullptr;
+
+			if (previous && previous->matches(info)) {
+				// Nothing was added, removed or renamed, take over the names of the last run.
+				// Files rewritten in place keep the directory unchanged, so each one is stat'ed.
+				for (const DirectoryIndex::File& file : previous->files) {
+					struct stat fileInfo;
+					if (fstatat(descriptor, file.name.c_str(), &fileInfo, 0)) {
+						memset(&fileInfo, 0, sizeof(fileInfo));
+					}
+					indexed.files.push_back(DirectoryIndex::File(file.name, fileInfo));
+					collect(worker, directory, file.name, fileInfo.st_size, file.matches(fileInfo));
+				}
+				subdirectories = previous->subdirectories;
+				return true;
+			}
+
+			workerIndexed[worker] = &indexed;
+			workerPrevious[worker] = previous;
+			return false;
+		};
+	}
+
+	walker.walk(path, [&](int worker, const string& directory, const string& name, const struct stat& info) {
+		bool unchanged = false;
+		if (isIndexed) {
+			workerIndexed[worker]->files.push_back(DirectoryIndex::File(name, info));
+			const DirectoryIndex::File* previous = workerPrevious[worker]
+				? DirectoryIndex::findFile(*workerPrevious[worker], name) : nullptr;
+			unchanged = previous && previous->matches(info);
+		}
+		collect(worker, directory, name, info.st_size, unchanged);
+	}, visitDirectory);
+
+	for (const string& failed : walker.failedDirectories()) {
+		cout << "Failed to read directory: " << failed << endl;
+	}
+
+	if (isIndexed) {
+		DirectoryIndex index;
+		for (DirectoryIndex& part : workerIndex) {
+			index.merge(part);
+		}
+		for (const string& failed : walker.failedDirectories()) {
+			index.addFailed(failed);
+		}
+		if (!index.save(indexFile, path)) {
+			cout << "Unable to write index." << endl;
+		}
+	}
+
+	// Merge the per thread statistics, sorted so the result does not depend on the threads
+	for (DirectoryMap& m : workerInfo) {
+		for (DirectoryMap::iterator it = m.begin(); it != m.end(); ++it) {
+			ExtensionInfo& info = dirinfo[it->first];
+			info.files += it->second.files;
+			info.memory += it->second.memory;
+			info.entries.insert(info.entries.end(), make_move_iterator(it->second.entries.begin()),
+			                    make_move_iterator(it->second.entries.end()));
+		}
+		m.clear();
+	}
+
+	if (rollup) {
+		for (DirectoryRollup& r : workerRollup) {
+			for (DirectoryRollup::iterator it = r.begin(); it != r.end(); ++it) {
+				DirectoryMap& totals = dirrollup[it->first];
+				for (DirectoryMap::const_iterator ext = it->second.begin(); ext != it->second.end(); ++ext) {
+					totals[ext->first].files += ext->second.files;
+					totals[ext->first].memory += ext->second.memory;
+				}
+			}
+			r.clear();
+		}
+		rollupDirectories(dirrollup, path);
+	}
+
+	// Files of the flattened hierarchy and their copies, named before any copying starts
+	vector<FileCopy> copies;
+
+	for (DirectoryMap::iterator it = dirinfo.begin(); it != dirinfo.end(); ++it) {
+		std::sort(it->second.entries.begin(), it->second.entries.end(), compareEntries);
+		if (it->second.entries.size() > maxEntries) {
+			it->second.entries.erase(it->second.entries.begin() + maxEntries, it->second.entries.end());
+		}
+
+		// Flatten hierarchy
+		if (!flattenDir.empty()) {
+			FileEntryList::const_iterator fileEntry;
+			for (fileEntry = it->second.entries.begin(); fileEntry != it->second.entries.end(); ++fileEntry) {
+				const string fullpath = *fileEntry->path + PATH_SEPERATOR + fileEntry->name;
+				copies.push_back(FileCopy(fullpath, flattenedPath(fullpath, flattenDir), fileEntry->size,
+				                          fileEntry->unchanged));
+			}
+		}
+	}
+
+	if (!flattenDir.empty()) {
+		flattenFiles(copies, threads, dedupe);
 	}
 }
 
@@ -240,6 +851,11 @@ void printHelp()
 	cout << "-fsize\t\t\tSummarized file size for files with same extension will be exported" << endl;
     cout << "-fnum\t\t\tSummarized number of files with same extension will be exported" << endl;
 	cout << "-files\t\t\tRelative paths of files with same extension will be exported" << endl;
+	cout << "-max-paths [N]\t\tAt most N paths per extension are exported with -files" << endl;
+	cout << "-dirs\t\t\tSummaries per directory and extension, including all subdirectories, are exported" << endl;
+	cout << "-dedupe\t\t\tFlattened files of equal content are hard linked instead of copied" << endl;
+	cout << "-index [FILE]\t\tIndex of the last run, only changed directories are read and copied again" << endl;
+	cout << "-threads [N]\t\tNumber of threads reading directories and copying files, defaults to the number of cores" << endl;
 }
 
 int main(int argc, char * argv[])
@@ -251,8 +867,10 @@ int main(int argc, char * argv[])
 	}
 
 	CSVConfig config;
-	string directory, outputFile, flattenDir;
+	string directory, outputFile, flattenDir, indexFile;
 	bool hasOutputFile = false;
+	bool dedupe = false;
+	int threads = std::max(1u, std::thread::hardware_concurrency());
     bool hasFlattenDir = false;
 
 	for (int i = 1; i < argc; i++) {
@@ -264,10 +882,29 @@ int main(int argc, char * argv[])
 			config.fnum = true;
 		} else if (arg == "-files") {
 			config.files = true;
+		} else if (arg == "-dirs") {
+			config.directories = true;
+		} else if (arg == "-dedupe" || arg == "--dedupe") {
+			dedupe = true;
 		} else if (arg == "-o") {
 			hasOutputFile = true;
 		} else if (arg == "-flat") {
             hasFlattenDir = true;
+        } else if ((arg == "-max-paths" || arg == "--max-paths") && i + 1 < argc) {
+            const long maxPaths = atol(argv[++i]);
+            if (maxPaths < 0) {
+                printHelp();
+                return -1;
+            }
+            config.maxPaths = maxPaths;
+        } else if (arg == "-index" && i + 1 < argc) {
+            indexFile = argv[++i];
+        } else if (arg == "-threads" && i + 1 < argc) {
+            threads = atoi(argv[++i]);
+            if (threads < 1) {
+                printHelp();
+                return -1;
+            }
         } else {
 			// First non-flag argument should be directory
 			if (!hasOutputFile && !hasFlattenDir && directory.empty()) {
@@ -298,9 +935,10 @@ int main(int argc, char * argv[])
         if (dir == nullptr) {
             createDirectory(flattenDir);
         }
-        traverseDirectory(directory, flattenDir);
+        traverseDirectory(directory, threads, UNLIMITED_PATHS, flattenDir, indexFile, dedupe, config.directories);
     } else {
-        traverseDirectory(directory);
+        traverseDirectory(directory, threads, (config.files && !config.directories) ? config.maxPaths : 0, "", indexFile,
+                          false, config.directories);
     }
 
 	if (hasOutputFile) {
@@ -5,11 +5,12 @@
 #include <regex>
 
 #include <vector>
+#include "csv_tokenizer.hpp"
 // works with no errors when compiled with flag -std=c++14
  
 std::ofstream logFile;		// global variable for fileio.log, the log-file is only created if there is at least one mistake
 
-bool isValueCorrect(const std::string &teststring, const int &column) {
+bool isValueCorrect(const StringRef &teststring, const int &column) {
 
 	std::regex regExp;
 	
@@ -37,33 +38,21 @@ bool isValueCorrect(const std::string &teststring, const int &column) {
 			break;
 	}
 	
-	return std::regex_match(teststring, regExp);
+	return std::regex_match(teststring.begin(), teststring.end(), regExp);
 }
 
 void readTokensAndLines(char* path) {
 
-	std::string delimiter = ",";
-	std::ifstream file;  // File-Handle
-	std::string line;
+	const char delimiter = ',';
+	CsvReader file(path, delimiter, true);	// File-Handle, commas within quoted names do not split
+	StringRef line;
+	std::vector<StringRef> elements;		// reused for every line, the entries point into the read buffer
 
-
-	file.open(path, std::ios::in);
-
-	if (file.is_open()) {
-		while (!file.eof() ) {          			// As long as the file isn't empty
-			getline(file, line);       				// read the next line
+	if (file.isOpen()) {
+		while (file.nextLine(line)) {			// As long as the file isn't empty, read the next line
 			if (!line.empty()) {
 
-				size_t last = 0;
-				size_t next = 0;
-
-				std::vector<std::string> elements;
-
-				while ((next = line.find(delimiter, last)) != std::string::npos) {
-					elements.push_back(line.substr(last, next-last));				// write all entries into a vector
-					last = next + 1;
-				}
-				elements.push_back(line.substr(last, next-last));
+				file.split(line, elements);		// write all entries into a vector
 				std::cout << elements.at(1) << " - " << elements.at(11) << "\n";	// only print out the name and timezone of the airport, that are on position 1 and 11
 
 				if (!isValueCorrect(elements.at(5), 5)) {				// test ICAO
@@ -89,7 +78,6 @@ void readTokensAndLines(char* path) {
 				}
 			}
 		}
-		file.close();
 		logFile.close();
 	}
 }
@@ -0,0 +1,67 @@
+#ifndef INCLUDE_FRAME_HPP
+#define INCLUDE_FRAME_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "counter_rng.hpp"
+#include "thread_pool.hpp"
+
+// Snapshot of one generation, 64 cells per word in the layout of BitRaster
+struct Frame {
+    Frame() : width(0), height(0), wordsPerRow(0), generation(0) {}
+
+    Frame(const std::string &file, int w, int h, uint64_t g = 0)
+        : filename(file)
+        , width(w)
+        , height(h)
+        , wordsPerRow((w + 63) / 64)
+        , generation(g)
+        , words(static_cast<size_t>(wordsPerRow) * h, 0)
+    {
+    }
+
+    bool get(int x, int y) const
+    {
+        return (row(y)[x / 64] >> (x % 64)) & 1;
+    }
+
+    void set(int x, int y)
+    {
+        words[static_cast<size_t>(y) * wordsPerRow + x / 64] |= uint64_t(1) << (x % 64);
+    }
+
+    uint64_t* row(int y) { return &words[static_cast<size_t>(y) * wordsPerRow]; }
+    const uint64_t* row(int y) const { return &words[static_cast<size_t>(y) * wordsPerRow]; }
+
+    std::string filename;
+    int width;
+    int height;
+    int wordsPerRow;
+    uint64_t generation;
+    std::vector<uint64_t> words;
+};
+
+// Board where every cell is alive with the seed probability, drawn 64 cells at a time
+inline Frame seedFrame(int width, int height, float seedProbability, const CounterRng &rng, ThreadPool &pool)
+{
+    Frame frame("", width, height);
+    const RandomMask mask(seedProbability);
+    const uint64_t lastWordMask = (width % 64) ? (uint64_t(1) << (width % 64)) - 1 : ~uint64_t(0);
+
+    pool.parallelFor(height, pool.bandHeight(height, frame.wordsPerRow * sizeof(uint64_t)), [&](int begin, int end) {
+        for (int y = begin; y < end; ++y) {
+            uint64_t* row = frame.row(y);
+            for (int w = 0; w < frame.wordsPerRow; ++w) {
+                row[w] = mask.draw(rng, CounterRng::SEEDING, 0, y, w);
+            }
+            if (frame.wordsPerRow > 0) {
+                row[frame.wordsPerRow - 1] &= lastWordMask;
+            }
+        }
+    });
+
+    return frame;
+}
+
+#endif
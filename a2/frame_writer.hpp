@@ -0,0 +1,190 @@
+#ifndef INCLUDE_FRAME_WRITER_HPP
+#define INCLUDE_FRAME_WRITER_HPP
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "frame.hpp"
+#include "pattern_io.hpp"
+
+// Encodes frames on a background thread, so the simulation only pays for taking the
+// snapshot. At most maxQueued frames wait for the disk before push() blocks.
+class FrameWriter
+{
+public:
+    enum Format {
+        BMP,    // 24 bit bitmap, black cells on white
+        BMP1,   // 1 bit bitmap with a black and white palette, 1/24 of the size
+        PBM,    // binary portable bitmap (P4), one bit per cell
+        RAW,    // the frame words as stored in memory, no header
+        RLE,    // Life run length encoding
+        GOL     // snapshot including the generation, can be loaded to resume a run
+    };
+
+    // rule is recorded in the header of RLE frames
+    FrameWriter(Format format, const std::string &rule = "B3/S23", size_t maxQueued = 4)
+        : format_(format)
+        , rule_(rule)
+        , maxQueued_(maxQueued)
+        , stop_(false)
+        , worker_(&FrameWriter::work, this)
+    {
+    }
+
+    ~FrameWriter()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        notEmpty_.notify_one();
+        worker_.join();
+    }
+
+    FrameWriter(const FrameWriter&) = delete;
+    FrameWriter& operator=(const FrameWriter&) = delete;
+
+    static const char* extension(Format format)
+    {
+        switch (format) {
+            case PBM: return ".pbm";
+            case RAW: return ".raw";
+            case RLE: return ".rle";
+            case GOL: return ".gol";
+            default: return ".bmp";
+        }
+    }
+
+    Format format() const { return format_; }
+
+    void push(Frame &&frame)
+    {
+        push(std::move(frame), format_);
+    }
+
+    void push(Frame &&frame, Format format)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        notFull_.wait(lock, [this]() { return queue_.size() < maxQueued_; });
+        queue_.push_back(std::make_pair(std::move(frame), format));
+        lock.unlock();
+        notEmpty_.notify_one();
+    }
+
+    static void write(const Frame &frame, Format format, const std::string &rule = "B3/S23")
+    {
+        if (format == BMP) {
+            writeBmp(frame);
+            return;
+        }
+
+        std::ofstream stream(frame.filename.c_str(), std::ios::binary);
+
+        if (!stream) {
+            std::cerr << "Could not open " << frame.filename << " for writing!" << std::endl;
+            return;
+        }
+
+        switch (format) {
+            case BMP1: writeBmp1(frame, stream); break;
+            case PBM: writePbm(frame, stream); break;
+            case RAW: writeRaw(frame, stream); break;
+            case RLE: writeRle(frame, stream, rule); break;
+            case GOL: writeSnapshot(frame, stream); break;
+            default: break;
+        }
+    }
+
+protected:
+    void work()
+    {
+        for (;;) {
+            std::unique_lock<std::mutex> lock(mutex_);
+            notEmpty_.wait(lock, [this]() { return stop_ || !queue_.empty(); });
+            if (queue_.empty()) {
+                return; // stopped and drained
+            }
+            std::pair<Frame, Format> job = std::move(queue_.front());
+            queue_.pop_front();
+            lock.unlock();
+            notFull_.notify_one();
+
+            write(job.first, job.second, rule_);
+        }
+    }
+
+    // Writes the 24 bit rows straight from the cell bits into a mapping of the file,
+    // one row at a time
+    static void writeBmp(const Frame &frame)
+    {
+        const rgb_store black = { 0, 0, 0 };
+        const rgb_store white = { 255, 255, 255 };
+        bitmap_image::save_bit_mask_rgb(frame.filename, frame.width, frame.height, frame.words.data(), frame.wordsPerRow, black, white);
+    }
+
+    static void writeBmp1(const Frame &frame, std::ofstream &stream)
+    {
+        const rgb_store black = { 0, 0, 0 };
+        const rgb_store white = { 255, 255, 255 };
+        bitmap_image::write_bit_mask(stream, frame.width, frame.height, frame.words.data(), frame.wordsPerRow, black, white);
+    }
+
+    struct ReversedBytes {
+        ReversedBytes()
+        {
+            for (int i = 0; i < 256; ++i) {
+                unsigned char r = 0;
+                for (int b = 0; b < 8; ++b) {
+                    r |= ((i >> b) & 1) << (7 - b);
+                }
+                table[i] = r;
+            }
+        }
+
+        unsigned char table[256];
+    };
+
+    // PBM expects the leftmost pixel in the most significant bit, with 1 meaning black
+    static void writePbm(const Frame &frame, std::ofstream &stream)
+    {
+        static const ReversedBytes reversed;
+
+        stream << "P4\n" << frame.width << " " << frame.height << "\n";
+
+        const int rowBytes = (frame.width + 7) / 8;
+        std::vector<char> bytes(rowBytes);
+
+        for (int y = 0; y < frame.height; ++y) {
+            const uint64_t* row = frame.row(y);
+            for (int i = 0; i < rowBytes; ++i) {
+                bytes[i] = static_cast<char>(reversed.table[(row[i / 8] >> (8 * (i % 8))) & 0xFF]);
+            }
+            stream.write(&bytes[0], rowBytes);
+        }
+    }
+
+    static void writeRaw(const Frame &frame, std::ofstream &stream)
+    {
+        stream.write(reinterpret_cast<const char*>(frame.words.data()), frame.words.size() * sizeof(uint64_t));
+    }
+
+    Format format_;
+    std::string rule_;
+    size_t maxQueued_;
+    std::deque<std::pair<Frame, Format> > queue_;
+    std::mutex mutex_;
+    std::condition_variable notEmpty_;
+    std::condition_variable notFull_;
+    bool stop_;
+    std::thread worker_;
+};
+
+#endif
@@ -1,97 +1,20 @@
 #include <iostream>
 #include <ctime>
 #include <cstring>
+#include <cstdio>
+#include <algorithm>
+#include <climits>
+#include <utility>
 #include "bitmap_image.hpp"
-
-const unsigned char COLOR_BLACK = 0;
-const unsigned char COLOR_WHITE = 255;
-
-const unsigned char ALIVE = 1;
-const unsigned char DEAD = 0;
-
-struct Raster {
-    Raster(int w, int h) : width(w), height(h)
-    {
-        data = new int[width*height];
-    }
-
-    Raster(int w, int h, float seedProbability) : width(w), height(h)
-    {
-        data = new int[size];
-
-        for (int i = 0; i < size; i++) {
-            float random = static_cast<float>(rand()) / static_cast<float>(RAND_MAX);
-            if (random < seedProbability) {
-                data[i] = ALIVE;
-            }
-        }
-    }
-
-    Raster(const std::string &filename)
-    {
-        bitmap_image image(filename);
-
-        if (!image)
-        {
-            std::cerr << "Could not open bitmap!" << std::endl;
-        }
-
-        height = image.height();
-        width = image.width();
-
-        data = new int[width*height];
-
-        unsigned char red;
-        unsigned char green;
-        unsigned char blue;
-
-        for (int y = 0; y < height; ++y) {
-            for (int x = 0; x < width; ++x) {
-                image.get_pixel(x, y, red, green, blue);
-                if (red == COLOR_BLACK && green == COLOR_BLACK && blue == COLOR_BLACK) {
-                    data[index(x,y)] = ALIVE;
-                }
-            }
-        }
-    }
-
-    void save(const std::string &filename)
-    {
-        bitmap_image image(width, height);
-
-        image.set_all_channels(COLOR_WHITE, COLOR_WHITE, COLOR_WHITE);
-
-        for (int y = 0; y < height; ++y) {
-            for (int x = 0; x < width; ++x) {
-                unsigned char color = (data[index(x,y)] == ALIVE) ? COLOR_BLACK : COLOR_WHITE;
-                image.set_pixel(x, y, color, color, color);
-            }
-        }
-
-        image.save_image(filename);
-    }
-
-    bool inBounds(const int &x, const int &y) const {
-        if (x < 0 || y < 0 || x > width-1 || y > height-1) {
-            return false;
-        }
-        return true;
-    }
-
-    ~Raster()
-    {
-        delete[] data;
-    }
-
-    size_t index(int x, int y) const { return x + width * y; }
-    size_t x(int index) const { return index % width; }
-    size_t y(int index) const { return (index - x(index)) / width; }
-
-    int width;
-    int height;
-    int size = width*height;
-    int* data;
-};
+#include "bit_raster.hpp"
+#include "counter_rng.hpp"
+#include "frame.hpp"
+#include "frame_writer.hpp"
+#include "hashlife.hpp"
+#include "life_rule.hpp"
+#include "pattern_io.hpp"
+#include "raster.hpp"
+#include "thread_pool.hpp"
 
 // This struct parses all necessary command line parameters. It is already complete and doesn't have to be modified. However - feel free to add support for additional arguments if you like.
 struct CommandLineParameter
@@ -99,9 +22,26 @@ struct CommandLineParameter
     CommandLineParameter(int argc, char* argv[])
         : width(0)
         , height(0)
+        , seedProbability(0)
         , invasionFactor(0)
         , isTorus(false)
         , maxIterations(20)
+        , engine("dense")
+        , threads(1)
+        , isSparse(false)
+        , stepLog2(0)
+        , hasViewport(false)
+        , viewportX(0)
+        , viewportY(0)
+        , viewportWidth(0)
+        , viewportHeight(0)
+        , saveEvery(1)
+        , saveFinalOnly(false)
+        , outputFormat(FrameWriter::BMP)
+        , checkpointEvery(0)
+        , hasSeed(false)
+        , seed(0)
+        , hasRule(false)
     {
         if (argc % 2 == 0)
         {
@@ -143,6 +83,118 @@ struct CommandLineParameter
             {
                 maxIterations = atoi(argv[i + 1]);
             }
+            else if (!strcmp(argv[i], "-engine"))
+            {
+                engine = argv[i + 1];
+            }
+            else if (!strcmp(argv[i], "-threads"))
+            {
+                threads = atoi(argv[i + 1]);
+            }
+            else if (!strcmp(argv[i], "-sparse"))
+            {
+                isSparse = strcmp(argv[i + 1], "0") != 0;
+            }
+            else if (!strcmp(argv[i], "-step"))
+            {
+                stepLog2 = atoi(argv[i + 1]);
+            }
+            else if (!strcmp(argv[i], "-save-every"))
+            {
+                saveEvery = atoi(argv[i + 1]);
+            }
+            else if (!strcmp(argv[i], "-save-final-only"))
+            {
+                saveFinalOnly = strcmp(argv[i + 1], "0") != 0;
+            }
+            else if (!strcmp(argv[i], "-format"))
+            {
+                if (!strcmp(argv[i + 1], "bmp"))
+                {
+                    outputFormat = FrameWriter::BMP;
+                }
+                else if (!strcmp(argv[i + 1], "bmp1"))
+                {
+                    outputFormat = FrameWriter::BMP1;
+                }
+                else if (!strcmp(argv[i + 1], "pbm"))
+                {
+                    outputFormat = FrameWriter::PBM;
+                }
+                else if (!strcmp(argv[i + 1], "raw"))
+                {
+                    outputFormat = FrameWriter::RAW;
+                }
+                else if (!strcmp(argv[i + 1], "rle"))
+                {
+                    outputFormat = FrameWriter::RLE;
+                }
+                else if (!strcmp(argv[i + 1], "gol"))
+                {
+                    outputFormat = FrameWriter::GOL;
+                }
+                else
+                {
+                    std::cerr << "Unknown format " << argv[i + 1] << ", falling back to bmp." << std::endl;
+                }
+            }
+            else if (!strcmp(argv[i], "-checkpoint-every"))
+            {
+                checkpointEvery = atoi(argv[i + 1]);
+            }
+            else if (!strcmp(argv[i], "-seed"))
+            {
+                hasSeed = true;
+                seed = strtoull(argv[i + 1], nullptr, 10);
+            }
+            else if (!strcmp(argv[i], "-rule"))
+            {
+                hasRule = LifeRule::parse(argv[i + 1], rule);
+                if (!hasRule)
+                {
+                    std::cerr << "Rule has a invalid value, falling back to B3/S23." << std::endl;
+                }
+            }
+            else if (!strcmp(argv[i], "-viewport"))
+            {
+                hasViewport = sscanf(argv[i + 1], "%lld,%lld,%d,%d",
+                    &viewportX, &viewportY, &viewportWidth, &viewportHeight) == 4
+                    && viewportWidth > 0 && viewportHeight > 0;
+                if (!hasViewport)
+                {
+                    std::cerr << "Viewport has to be given as x,y,width,height." << std::endl;
+                }
+            }
+        }
+
+        if (engine != "dense" && engine != "bitpacked" && engine != "hashlife")
+        {
+            std::cerr << "Unknown engine " << engine << ", falling back to dense." << std::endl;
+            engine = "dense";
+        }
+
+        if (threads < 1)
+        {
+            std::cerr << "Number of threads has a invalid value." << std::endl;
+            threads = 1;
+        }
+
+        if (isSparse && engine != "bitpacked")
+        {
+            std::cout << "Sparse stepping is only available for the bitpacked engine." << std::endl;
+            isSparse = false;
+        }
+
+        if (saveEvery < 1)
+        {
+            std::cerr << "Save interval has a invalid value." << std::endl;
+            saveEvery = 1;
+        }
+
+        if (stepLog2 < 0 || stepLog2 > HashLife::MAX_STEP_LOG2)
+        {
+            std::cerr << "Step has a invalid value." << std::endl;
+            stepLog2 = 0;
         }
 
         if ((width != 0 || height != 0) && !patternFilename.empty())
@@ -166,116 +218,259 @@ struct CommandLineParameter
     float invasionFactor;
     bool isTorus;
     int maxIterations;
-};
-
-int neighborValue(const Raster &raster, int x, int y, bool isTorus)
-{
-    int numNeighbours = 0;
-
-    for (int yy = y-1; yy <= y+1; yy++) {
-        for (int xx = x-1; xx <= x+1; xx++) {
-            if (xx == x && yy == y) {
-                continue; // not a neighbour
-            }
+    std::string engine;
+    int threads;
+    bool isSparse;          // bitpacked engine only recomputes tiles next to changes
+    int stepLog2;           // hashlife advances 2^stepLog2 generations per iteration
+    bool hasViewport;
+    long long viewportX;
+    long long viewportY;
+    int viewportWidth;
+    int viewportHeight;
+    int saveEvery;
+    bool saveFinalOnly;
+    FrameWriter::Format outputFormat;
+    int checkpointEvery;    // write a resumable .gol snapshot every n iterations, 0 disables
+    bool hasSeed;           // without a seed the current time is used
+    unsigned long long seed;
+    bool hasRule;           // without a rule the one of an RLE pattern or Conway's is used
+    LifeRule rule;
+
+    bool savesIteration(int iteration) const
+    {
+        if (saveFinalOnly)
+        {
+            return iteration == maxIterations;
+        }
+        return iteration % saveEvery == 0;
+    }
 
-            bool inBounds = raster.inBounds(xx,yy);
+    bool checkpointsIteration(int iteration) const
+    {
+        if (checkpointEvery <= 0 || iteration % checkpointEvery != 0)
+        {
+            return false;
+        }
+        // a .gol frame already is a checkpoint
+        return outputFormat != FrameWriter::GOL || !savesIteration(iteration);
+    }
 
-            if (!isTorus && !inBounds) {
-                continue; // i.e. dead
-            }
+    std::string frameFilename(unsigned long long generation) const
+    {
+        return outputDirectory + "game_of_life_" + std::to_string(generation) + FrameWriter::extension(outputFormat);
+    }
 
-            int actualX = xx;
-            int actualY = yy;
+    std::string checkpointFilename(unsigned long long generation) const
+    {
+        return outputDirectory + "game_of_life_" + std::to_string(generation) + FrameWriter::extension(FrameWriter::GOL);
+    }
+};
 
-            if (!inBounds) {
-                // transform to torus
-                actualX = (xx + raster.width) % raster.width;
-                actualY = (yy + raster.height) % raster.height;
-            }
+// takes over the words of the frame instead of copying a possibly huge board
+BitRaster packFrame(Frame &&frame)
+{
+    BitRaster bits(frame.width, frame.height);
+    bits.words.swap(frame.words);
+    return bits;
+}
 
-            const int currentCellState = raster.data[raster.index(actualX, actualY)];
+Frame snapshot(const Raster &raster, const std::string &filename, unsigned long long generation)
+{
+    Frame frame(filename, raster.width, raster.height, generation);
 
-            if (currentCellState == ALIVE) {
-                numNeighbours++;
+    for (int y = 0; y < raster.height; ++y) {
+        for (int x = 0; x < raster.width; ++x) {
+            if (raster.data[raster.index(x,y)] == ALIVE) {
+                frame.set(x, y);
             }
         }
     }
 
-    const int cellState = raster.data[raster.index(x,y)];
+    return frame;
+}
 
-    // apply rules
-    int newState = DEAD;
-    if (cellState == DEAD && numNeighbours == 3) {
-        newState = ALIVE;
-    } else if (cellState == ALIVE && (numNeighbours == 2 || numNeighbours == 3)) {
-        newState = ALIVE;
-    }
+Frame snapshot(const BitRaster &bits, const std::string &filename, unsigned long long generation)
+{
+    Frame frame(filename, bits.width, bits.height, generation);
+    frame.words = bits.words;
+    return frame;
+}
 
-    return newState;
+Frame snapshot(const HashLife &life, const std::string &filename, long long x, long long y, int width, int height)
+{
+    Frame frame(filename, width, height, life.generation());
+    life.forEachAlive(x, y, width, height, [&](int cellX, int cellY) {
+        frame.set(cellX, cellY);
+    });
+    return frame;
 }
 
-void simulateInvasion(Raster &raster, float invasionFactor)
+// Reads the pattern file (bitmap, RLE or snapshot) or seeds a random board. RLE
+// patterns also return the rule given in their header.
+bool loadInitialState(const CommandLineParameter &cmd, const CounterRng &rng, ThreadPool &pool, Frame &initial,
+                      std::string &patternRule)
 {
-    if (invasionFactor <= 0)
+    if (hasExtension(cmd.patternFilename, ".rle"))
     {
-        return;
+        return loadRle(cmd.patternFilename, initial, patternRule);
+    }
+    if (hasExtension(cmd.patternFilename, ".gol"))
+    {
+        return loadSnapshot(cmd.patternFilename, initial);
     }
 
-    for (int y = 0; y < raster.height; ++y) {
-        for (int x = 0; x < raster.width; ++x) {
-            float random = static_cast<float>(rand()) / static_cast<float>(RAND_MAX);
-            if (random < invasionFactor) {
-                int index = raster.index(x,y);
-                // flip cell state
-                raster.data[index] = (raster.data[index] + 1) % 2;
-            }
-        }
+    if (!cmd.patternFilename.empty())
+    {
+        return loadBitmap(cmd.patternFilename, initial);
     }
+
+    initial = seedFrame(cmd.width, cmd.height, cmd.seedProbability, rng, pool);
+    return true;
 }
 
-void simulateNextState(Raster &raster, bool isTorus)
+// The rule given on the command line wins over the one of the pattern. Falls back to
+// the dense engine if the chosen one cannot simulate the rule.
+LifeRule selectRule(CommandLineParameter &cmd, const std::string &patternRule)
 {
-    const int width = raster.width;
-    const int height = raster.height;
+    LifeRule rule = cmd.rule;
 
-    int* data = new int[width*height];
+    if (!cmd.hasRule && !patternRule.empty() && !LifeRule::parse(patternRule, rule))
+    {
+        std::cerr << "Unknown rule " << patternRule << " in pattern, falling back to B3/S23." << std::endl;
+    }
 
-    for (int y = 0; y < height; ++y) {
-        for (int x = 0; x < width; ++x) {
-            int index = raster.index(x,y);
-            data[index] = neighborValue(raster, x, y, isTorus);
-        }
+    if (rule.isGenerations() && cmd.engine != "dense")
+    {
+        std::cout << "Generations rules are only available for the dense engine." << std::endl;
+        cmd.engine = "dense";
+        cmd.isSparse = false;
     }
 
-    delete[] raster.data;
+    if (rule.bornWithoutNeighbours() && cmd.engine == "hashlife")
+    {
+        std::cout << "HashLife cannot simulate rules with B0, falling back to dense." << std::endl;
+        cmd.engine = "dense";
+    }
 
-    raster.data = data;
+    return rule;
 }
 
 int main(int argc, char* argv[])
 {
-    Raster* raster = nullptr;
     CommandLineParameter cmd(argc, argv);
 
-    srand(time(NULL));
+    const CounterRng rng(cmd.hasSeed ? cmd.seed : static_cast<unsigned long long>(time(NULL)));
+    ThreadPool pool(cmd.threads);
 
-    if (!cmd.patternFilename.empty())
+    Frame initial;
+    std::string patternRule;
+    if (!loadInitialState(cmd, rng, pool, initial, patternRule))
     {
-        raster = new Raster(cmd.patternFilename);
+        return -1;
     }
-    else
+
+    const LifeRule rule = selectRule(cmd, patternRule);
+    FrameWriter writer(cmd.outputFormat, rule.name());
+
+    // snapshots resume at the generation they were taken, hashlife snapshots can be far
+    // beyond any iteration count and then leave nothing to simulate
+    const int firstIteration = static_cast<int>(std::min<uint64_t>(initial.generation, INT_MAX));
+
+    if (cmd.engine == "bitpacked")
     {
-        raster = new Raster(cmd.width, cmd.height, cmd.seedProbability);
-    }
+        BitRaster bits = packFrame(std::move(initial));
+
+        for (int iteration = firstIteration; iteration <= cmd.maxIterations; iteration++)
+        {
+            if (cmd.savesIteration(iteration))
+            {
+                writer.push(snapshot(bits, cmd.frameFilename(iteration), iteration));
+            }
+            if (cmd.checkpointsIteration(iteration))
+            {
+                writer.push(snapshot(bits, cmd.checkpointFilename(iteration), iteration), FrameWriter::GOL);
+            }
+            simulateInvasion(bits, cmd.invasionFactor, rng, iteration, &pool);
+            if (cmd.isSparse)
+            {
+                simulateNextStateSparse(bits, cmd.isTorus, rule, &pool);
+            }
+            else
+            {
+                simulateNextState(bits, cmd.isTorus, rule, &pool);
+            }
+        }
 
-    for (int iteration = 0; iteration <= cmd.maxIterations; iteration++)
+        if (cmd.isSparse)
+        {
+            const uint64_t tiles = bits.computedTiles + bits.skippedTiles;
+            std::cout << "Skipped " << bits.skippedTiles << " of " << tiles << " tiles ("
+                << (tiles ? 100.0 * bits.skippedTiles / tiles : 0.0) << "%)." << std::endl;
+        }
+    }
+    else if (cmd.engine == "hashlife")
     {
-        raster->save(cmd.outputDirectory + "game_of_life_" + std::to_string(iteration) + ".bmp");
-        simulateInvasion(*raster, cmd.invasionFactor);
-        simulateNextState(*raster, cmd.isTorus);
+        if (cmd.isTorus || cmd.invasionFactor > 0)
+        {
+            std::cout << "HashLife simulates an unbounded plane without invasion, -t and -iv are ignored." << std::endl;
+        }
+
+        HashLife life(rule);
+        life.load(initial.width, initial.height, [&](int x, int y) {
+            return initial.get(x, y);
+        }, initial.generation);
+
+        // export the initial board unless a different region was requested
+        long long viewportX = 0;
+        long long viewportY = 0;
+        int viewportWidth = initial.width;
+        int viewportHeight = initial.height;
+        if (cmd.hasViewport)
+        {
+            viewportX = cmd.viewportX;
+            viewportY = cmd.viewportY;
+            viewportWidth = cmd.viewportWidth;
+            viewportHeight = cmd.viewportHeight;
+        }
+
+        for (int iteration = 0; iteration <= cmd.maxIterations; iteration++)
+        {
+            if (cmd.savesIteration(iteration))
+            {
+                writer.push(snapshot(life, cmd.frameFilename(life.generation()),
+                    viewportX, viewportY, viewportWidth, viewportHeight));
+            }
+            if (cmd.checkpointsIteration(iteration))
+            {
+                // only the viewport of the unbounded universe is kept
+                writer.push(snapshot(life, cmd.checkpointFilename(life.generation()),
+                    viewportX, viewportY, viewportWidth, viewportHeight), FrameWriter::GOL);
+            }
+            if (!life.advance(cmd.stepLog2))
+            {
+                std::cerr << "The pattern outgrew the hashlife universe at generation " << life.generation() << "." << std::endl;
+                break;
+            }
+        }
     }
+    else
+    {
+        Raster raster(initial);
 
-    delete raster;
+        for (int iteration = firstIteration; iteration <= cmd.maxIterations; iteration++)
+        {
+            if (cmd.savesIteration(iteration))
+            {
+                writer.push(snapshot(raster, cmd.frameFilename(iteration), iteration));
+            }
+            if (cmd.checkpointsIteration(iteration))
+            {
+                writer.push(snapshot(raster, cmd.checkpointFilename(iteration), iteration), FrameWriter::GOL);
+            }
+            simulateInvasion(raster, cmd.invasionFactor, rng, iteration, &pool);
+            simulateNextState(raster, cmd.isTorus, rule, &pool);
+        }
+    }
 
     return 0;
 }
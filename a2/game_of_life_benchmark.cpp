@@ -0,0 +1,233 @@
+#include <iostream>
+#include <fstream>
+#include <cstring>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include "benchmark_options.hpp"
+#include "bit_raster.hpp"
+#include "counter_rng.hpp"
+#include "frame.hpp"
+#include "hashlife.hpp"
+#include "life_rule.hpp"
+#include "raster.hpp"
+#include "thread_pool.hpp"
+
+// Measures the throughput of the game_of_life engines over every combination of the
+// given board sizes, seed densities, torus modes, engines and thread counts and
+// prints one CSV line per combination, e.g.
+//
+//   game_of_life_benchmark -sizes 256,1024,4096x1024 -densities 0.1,0.5 -engines dense,bitpacked -o results.csv
+
+struct BenchmarkParameter : BenchmarkOptions
+{
+    BenchmarkParameter(int argc, char* argv[])
+        : BenchmarkOptions("256,1024,4096")
+    {
+        std::string densitiesText = "0.1,0.3,0.5";
+        std::string torusText = "0,1";
+        std::string enginesText = "dense,bitpacked,sparse,hashlife";
+        std::string threadsText = "1";
+
+        parse(argc, argv, [&](const char* name, const char* value) {
+            if (!strcmp(name, "-densities"))
+            {
+                densitiesText = value;
+            }
+            else if (!strcmp(name, "-t"))
+            {
+                torusText = value;
+            }
+            else if (!strcmp(name, "-engines"))
+            {
+                enginesText = value;
+            }
+            else if (!strcmp(name, "-threads"))
+            {
+                threadsText = value;
+            }
+            else if (!strcmp(name, "-rule"))
+            {
+                if (!LifeRule::parse(value, rule))
+                {
+                    std::cerr << "Rule has a invalid value, falling back to B3/S23." << std::endl;
+                }
+            }
+        });
+
+        for (const std::string &density : split(densitiesText))
+        {
+            densities.push_back(static_cast<float>(atof(density.c_str())));
+        }
+
+        for (const std::string &torus : split(torusText))
+        {
+            torusModes.push_back(torus != "0");
+        }
+
+        for (const std::string &engine : split(enginesText))
+        {
+            if (engine != "dense" && engine != "bitpacked" && engine != "sparse" && engine != "hashlife")
+            {
+                std::cerr << "Unknown engine " << engine << " is skipped." << std::endl;
+                continue;
+            }
+            engines.push_back(engine);
+        }
+
+        for (const std::string &threads : split(threadsText))
+        {
+            const int count = atoi(threads.c_str());
+            if (count < 1)
+            {
+                std::cerr << "Number of threads has a invalid value." << std::endl;
+                continue;
+            }
+            threadCounts.push_back(count);
+        }
+    }
+
+    std::vector<float> densities;
+    std::vector<bool> torusModes;
+    std::vector<std::string> engines;   // sparse is the bitpacked engine with tile tracking
+    std::vector<int> threadCounts;
+    LifeRule rule;
+};
+
+struct Measurement
+{
+    uint64_t generations;
+    double seconds;
+    double bytesPerGeneration;  // lower bound of the memory traffic, 0 if unknown
+};
+
+// Steps the board until minSeconds have passed, after one untimed warm-up generation
+template<typename Step>
+Measurement measureGenerations(double minSeconds, Step step)
+{
+    const Timing timing = measure(minSeconds, step);
+    const Measurement measurement = { timing.iterations, timing.seconds, 0.0 };
+    return measurement;
+}
+
+Measurement benchmark(const std::string &engine, const Frame &initial, bool isTorus, const LifeRule &rule,
+                      double minSeconds, ThreadPool &pool)
+{
+    if (engine == "dense")
+    {
+        Raster raster(initial);
+        Measurement measurement = measureGenerations(minSeconds, [&]() {
+            simulateNextState(raster, isTorus, rule, &pool);
+        });
+        // every cell is read from the current and written to the next generation
+        measurement.bytesPerGeneration = 2.0 * raster.size * sizeof(int);
+        return measurement;
+    }
+
+    if (engine == "hashlife")
+    {
+        HashLife life(rule);
+        life.load(initial.width, initial.height, [&](int x, int y) {
+            return initial.get(x, y);
+        });
+        return measureGenerations(minSeconds, [&]() {
+            life.advance(0);
+        });
+    }
+
+    BitRaster bits(initial.width, initial.height);
+    bits.words = initial.words;
+
+    if (engine == "sparse")
+    {
+        Measurement measurement = measureGenerations(minSeconds, [&]() {
+            simulateNextStateSparse(bits, isTorus, rule, &pool);
+        });
+        // only the recomputed tiles are read and written
+        const double tileBytes = 2.0 * BitRaster::TILE_WORDS * BitRaster::TILE_ROWS * sizeof(uint64_t);
+        const uint64_t tiles = bits.computedTiles + bits.skippedTiles;
+        measurement.bytesPerGeneration = tiles ? tileBytes * bits.computedTiles / tiles * bits.tileColumns * bits.tileRows : 0;
+        return measurement;
+    }
+
+    Measurement measurement = measureGenerations(minSeconds, [&]() {
+        simulateNextState(bits, isTorus, rule, &pool);
+    });
+    measurement.bytesPerGeneration = 2.0 * bits.words.size() * sizeof(uint64_t);
+    return measurement;
+}
+
+int main(int argc, char* argv[])
+{
+    BenchmarkParameter cmd(argc, argv);
+
+    std::ofstream file;
+    if (!cmd.openOutput(file))
+    {
+        return -1;
+    }
+    std::ostream &csv = cmd.outputFilename.empty() ? std::cout : file;
+
+    csv << "engine,threads,width,height,density,torus,rule,generations,seconds,"
+        << "cell_updates_per_second,ns_per_cell,bandwidth_gb_per_second" << std::endl;
+
+    const CounterRng rng(cmd.seed);
+    ThreadPool seedingPool(1);
+
+    for (size_t s = 0; s < cmd.widths.size(); ++s)
+    {
+        for (float density : cmd.densities)
+        {
+            const Frame initial = seedFrame(cmd.widths[s], cmd.heights[s], density, rng, seedingPool);
+
+            for (bool isTorus : cmd.torusModes)
+            {
+                for (const std::string &engine : cmd.engines)
+                {
+                    if (engine == "hashlife" && isTorus)
+                    {
+                        continue; // HashLife always simulates an unbounded plane
+                    }
+                    if ((engine != "dense" && cmd.rule.isGenerations())
+                        || (engine == "hashlife" && cmd.rule.bornWithoutNeighbours()))
+                    {
+                        continue; // see selectRule in game_of_life
+                    }
+
+                    for (int threads : cmd.threadCounts)
+                    {
+                        if (engine == "hashlife" && threads != cmd.threadCounts.front())
+                        {
+                            continue; // single threaded, one line is enough
+                        }
+
+                        ThreadPool pool(threads);
+                        const Measurement m = benchmark(engine, initial, isTorus, cmd.rule, cmd.minSeconds, pool);
+
+                        const double cells = double(initial.width) * initial.height * m.generations;
+                        const double bandwidth = m.bytesPerGeneration * m.generations / m.seconds / 1e9;
+
+                        csv << engine << ","
+                            << (engine == "hashlife" ? 1 : threads) << ","
+                            << initial.width << ","
+                            << initial.height << ","
+                            << density << ","
+                            << (isTorus ? 1 : 0) << ","
+                            << cmd.rule.name() << ","
+                            << m.generations << ","
+                            << m.seconds << ","
+                            << cells / m.seconds << ","
+                            << m.seconds * 1e9 / cells << ",";
+                        if (m.bytesPerGeneration > 0)
+                        {
+                            csv << bandwidth;
+                        }
+                        csv << std::endl;
+                    }
+                }
+            }
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,387 @@
+#ifndef INCLUDE_HASHLIFE_HPP
+#define INCLUDE_HASHLIFE_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "life_rule.hpp"
+
+// Square of 2^level x 2^level cells. Nodes are canonical: two nodes with the same
+// children are the same object, so equal regions anywhere in space and time share
+// one node and one memoized successor.
+struct HashNode {
+    const HashNode* nw;
+    const HashNode* ne;
+    const HashNode* sw;
+    const HashNode* se;
+    int level;
+    uint64_t population;
+
+    // centre of this node advanced by 2^resultStep generations, computed on demand
+    mutable const HashNode* result;
+    mutable int resultStep;
+};
+
+// HashLife simulation of a Life-like rule on an unbounded plane. Unlike the dense and
+// bit-packed rasters there is no board border: patterns may grow past the initial
+// board and are only clipped when exported through a viewport. Rules with B0 and
+// Generations rules are not supported, empty space has to stay empty.
+class HashLife
+{
+public:
+    explicit HashLife(const LifeRule &rule = LifeRule())
+        : rule_(rule)
+        , root_(nullptr)
+        , originX_(0)
+        , originY_(0)
+        , generation_(0)
+    {
+        HashNode dead = { nullptr, nullptr, nullptr, nullptr, 0, 0, nullptr, -1 };
+        HashNode alive = { nullptr, nullptr, nullptr, nullptr, 0, 1, nullptr, -1 };
+        nodes_.push_back(dead);
+        nodes_.push_back(alive);
+        emptyNodes_.push_back(&nodes_[0]);
+        root_ = empty(3);
+    }
+
+    HashLife(const HashLife&) = delete;
+    HashLife& operator=(const HashLife&) = delete;
+
+    // Replaces the universe with a width x height board whose top left cell is (0,0).
+    // isAlive(x, y) is queried once per cell.
+    template<typename IsAlive>
+    void load(int width, int height, IsAlive isAlive, uint64_t generation = 0)
+    {
+        int level = 3;
+        while ((int64_t(1) << level) < width || (int64_t(1) << level) < height) {
+            ++level;
+        }
+
+        root_ = build(0, 0, level, width, height, isAlive);
+        originX_ = 0;
+        originY_ = 0;
+        generation_ = generation;
+    }
+
+    // Largest root, its size and the positions of all of its cells fit into 64 bit integers
+    static const int MAX_LEVEL = 62;
+
+    // Largest step, the root grows to level stepLog2 + 3
+    static const int MAX_STEP_LOG2 = MAX_LEVEL - 3;
+
+    // Advances the universe by 2^stepLog2 generations in a single recursive step. Returns
+    // false and leaves the universe as it is if the step is out of range, or if the
+    // generation or the pattern would outgrow 64 bit coordinates.
+    bool advance(int stepLog2)
+    {
+        if (stepLog2 < 0 || stepLog2 > MAX_STEP_LOG2
+            || generation_ > UINT64_MAX - (uint64_t(1) << stepLog2)) {
+            return false;
+        }
+
+        const HashNode* const root = root_;
+        const int64_t originX = originX_;
+        const int64_t originY = originY_;
+
+        // The successor of a level k node is its centre square of half the size. Keeping
+        // the pattern inside the central quarter and the step at most 2^(k-3) guarantees
+        // that nothing moving at up to one cell per generation is lost.
+        while (root_->level < stepLog2 + 3 || !isCentred(root_)) {
+            if (!canCentre(root_)) {
+                root_ = root;
+                originX_ = originX;
+                originY_ = originY;
+                return false;
+            }
+            root_ = centre(root_);
+        }
+
+        const int64_t shift = int64_t(1) << (root_->level - 2);
+        root_ = successor(root_, stepLog2);
+        originX_ += shift;
+        originY_ += shift;
+        generation_ += uint64_t(1) << stepLog2;
+        return true;
+    }
+
+    bool get(int64_t x, int64_t y) const
+    {
+        const HashNode* node = root_;
+        x -= originX_;
+        y -= originY_;
+
+        if (x < 0 || y < 0 || x >= size(node) || y >= size(node)) {
+            return false;
+        }
+
+        while (node->level > 0 && node->population > 0) {
+            const int64_t half = int64_t(1) << (node->level - 1);
+            if (y < half) {
+                node = (x < half) ? node->nw : node->ne;
+            } else {
+                node = (x < half) ? node->sw : node->se;
+                y -= half;
+            }
+            if (x >= half) {
+                x -= half;
+            }
+        }
+
+        return node->population > 0;
+    }
+
+    // Calls setCell(x - viewX, y - viewY) for every living cell within the region
+    template<typename SetCell>
+    void forEachAlive(int64_t viewX, int64_t viewY, int width, int height, SetCell setCell) const
+    {
+        visit(root_, originX_, originY_, viewX, viewY, width, height, setCell);
+    }
+
+    uint64_t population() const { return root_->population; }
+    uint64_t generation() const { return generation_; }
+    size_t nodeCount() const { return nodes_.size(); }
+
+protected:
+    struct NodeKey {
+        const HashNode* nw;
+        const HashNode* ne;
+        const HashNode* sw;
+        const HashNode* se;
+
+        bool operator==(const NodeKey &other) const
+        {
+            return nw == other.nw && ne == other.ne && sw == other.sw && se == other.se;
+        }
+    };
+
+    struct NodeKeyHash {
+        size_t operator()(const NodeKey &key) const
+        {
+            std::hash<const HashNode*> hash;
+            size_t seed = hash(key.nw);
+            seed = seed * 31 + hash(key.ne);
+            seed = seed * 31 + hash(key.sw);
+            seed = seed * 31 + hash(key.se);
+            return seed ^ (seed >> 17);
+        }
+    };
+
+    static int64_t size(const HashNode* node)
+    {
+        return int64_t(1) << node->level;
+    }
+
+    const HashNode* leaf(bool alive) const
+    {
+        return &nodes_[alive ? 1 : 0];
+    }
+
+    // canonical node for the given children
+    const HashNode* join(const HashNode* nw, const HashNode* ne, const HashNode* sw, const HashNode* se)
+    {
+        const NodeKey key = { nw, ne, sw, se };
+        std::unordered_map<NodeKey, const HashNode*, NodeKeyHash>::const_iterator it = table_.find(key);
+
+        if (it != table_.end()) {
+            return it->second;
+        }
+
+        const HashNode node = { nw, ne, sw, se, nw->level + 1,
+                                nw->population + ne->population + sw->population + se->population,
+                                nullptr, -1 };
+        nodes_.push_back(node);
+        table_[key] = &nodes_.back();
+
+        return &nodes_.back();
+    }
+
+    const HashNode* empty(int level)
+    {
+        while (static_cast<int>(emptyNodes_.size()) <= level) {
+            const HashNode* e = emptyNodes_.back();
+            emptyNodes_.push_back(join(e, e, e, e));
+        }
+        return emptyNodes_[level];
+    }
+
+    template<typename IsAlive>
+    const HashNode* build(int64_t x, int64_t y, int level, int width, int height, IsAlive &isAlive)
+    {
+        if (x >= width || y >= height) {
+            return empty(level);
+        }
+        if (level == 0) {
+            return leaf(isAlive(static_cast<int>(x), static_cast<int>(y)));
+        }
+
+        const int64_t half = int64_t(1) << (level - 1);
+        return join(build(x, y, level - 1, width, height, isAlive),
+                    build(x + half, y, level - 1, width, height, isAlive),
+                    build(x, y + half, level - 1, width, height, isAlive),
+                    build(x + half, y + half, level - 1, width, height, isAlive));
+    }
+
+    // true if the node can grow by one level around its centre within MAX_LEVEL and
+    // 64 bit cell positions
+    bool canCentre(const HashNode* node) const
+    {
+        if (node->level >= MAX_LEVEL) {
+            return false;
+        }
+
+        const int64_t shift = int64_t(1) << (node->level - 1);
+        const int64_t grown = int64_t(1) << (node->level + 1);
+        return std::min(originX_, originY_) >= INT64_MIN + shift
+            && std::max(originX_, originY_) - shift <= INT64_MAX - grown;
+    }
+
+    // Node of the next level with the given node in its centre
+    const HashNode* centre(const HashNode* node)
+    {
+        const HashNode* e = empty(node->level - 1);
+        const int64_t shift = int64_t(1) << (node->level - 1);
+
+        originX_ -= shift;
+        originY_ -= shift;
+
+        return join(join(e, e, e, node->nw),
+                    join(e, e, node->ne, e),
+                    join(e, node->sw, e, e),
+                    join(node->se, e, e, e));
+    }
+
+    // true if every living cell lies within the central quarter of the node
+    static bool isCentred(const HashNode* node)
+    {
+        return node->level >= 3
+            && node->nw->population == node->nw->se->se->population
+            && node->ne->population == node->ne->sw->sw->population
+            && node->sw->population == node->sw->ne->ne->population
+            && node->se->population == node->se->nw->nw->population;
+    }
+
+    // one generation of the inner 2x2 cells of a level 2 node
+    const HashNode* step4x4(const HashNode* node)
+    {
+        int cells[4][4];
+        const HashNode* quadrants[4] = { node->nw, node->ne, node->sw, node->se };
+
+        for (int q = 0; q < 4; ++q) {
+            const HashNode* leaves[4] = { quadrants[q]->nw, quadrants[q]->ne, quadrants[q]->sw, quadrants[q]->se };
+            for (int l = 0; l < 4; ++l) {
+                cells[(q / 2) * 2 + l / 2][(q % 2) * 2 + l % 2] = static_cast<int>(leaves[l]->population);
+            }
+        }
+
+        const HashNode* next[4];
+        for (int i = 0; i < 4; ++i) {
+            const int y = 1 + i / 2;
+            const int x = 1 + i % 2;
+            int neighbours = 0;
+            for (int yy = y - 1; yy <= y + 1; ++yy) {
+                for (int xx = x - 1; xx <= x + 1; ++xx) {
+                    neighbours += cells[yy][xx];
+                }
+            }
+            neighbours -= cells[y][x];
+            next[i] = leaf(cells[y][x] ? rule_.survives(neighbours) : rule_.isBorn(neighbours));
+        }
+
+        return join(next[0], next[1], next[2], next[3]);
+    }
+
+    // Centre square (level - 1) of the node advanced by 2^min(stepLog2, level - 2) generations
+    const HashNode* successor(const HashNode* node, int stepLog2)
+    {
+        if (node->population == 0) {
+            return empty(node->level - 1);
+        }
+        if (node->level == 2) {
+            if (node->resultStep != 0) {
+                node->result = step4x4(node);
+                node->resultStep = 0;
+            }
+            return node->result;
+        }
+
+        const int step = std::min(stepLog2, node->level - 2);
+        if (node->resultStep == step) {
+            return node->result;
+        }
+
+        const HashNode* nw = node->nw;
+        const HashNode* ne = node->ne;
+        const HashNode* sw = node->sw;
+        const HashNode* se = node->se;
+
+        // nine overlapping subnodes of half the size, each advanced by up to half the step
+        const HashNode* c[9] = {
+            successor(nw, step),
+            successor(join(nw->ne, ne->nw, nw->se, ne->sw), step),
+            successor(ne, step),
+            successor(join(nw->sw, nw->se, sw->nw, sw->ne), step),
+            successor(join(nw->se, ne->sw, sw->ne, se->nw), step),
+            successor(join(ne->sw, ne->se, se->nw, se->ne), step),
+            successor(sw, step),
+            successor(join(sw->ne, se->nw, sw->se, se->sw), step),
+            successor(se, step)
+        };
+
+        const HashNode* result;
+        if (step < node->level - 2) {
+            // the subnodes already cover the whole step, only recombine their centres
+            result = join(join(c[0]->se, c[1]->sw, c[3]->ne, c[4]->nw),
+                          join(c[1]->se, c[2]->sw, c[4]->ne, c[5]->nw),
+                          join(c[3]->se, c[4]->sw, c[6]->ne, c[7]->nw),
+                          join(c[4]->se, c[5]->sw, c[7]->ne, c[8]->nw));
+        } else {
+            result = join(successor(join(c[0], c[1], c[3], c[4]), step),
+                          successor(join(c[1], c[2], c[4], c[5]), step),
+                          successor(join(c[3], c[4], c[6], c[7]), step),
+                          successor(join(c[4], c[5], c[7], c[8]), step));
+        }
+
+        node->result = result;
+        node->resultStep = step;
+        return result;
+    }
+
+    template<typename SetCell>
+    static void visit(const HashNode* node, int64_t nodeX, int64_t nodeY,
+                      int64_t viewX, int64_t viewY, int width, int height, SetCell &setCell)
+    {
+        const int64_t extent = size(node);
+
+        if (node->population == 0
+            || nodeX >= viewX + width || nodeX + extent <= viewX
+            || nodeY >= viewY + height || nodeY + extent <= viewY) {
+            return;
+        }
+
+        if (node->level == 0) {
+            setCell(static_cast<int>(nodeX - viewX), static_cast<int>(nodeY - viewY));
+            return;
+        }
+
+        const int64_t half = extent / 2;
+        visit(node->nw, nodeX, nodeY, viewX, viewY, width, height, setCell);
+        visit(node->ne, nodeX + half, nodeY, viewX, viewY, width, height, setCell);
+        visit(node->sw, nodeX, nodeY + half, viewX, viewY, width, height, setCell);
+        visit(node->se, nodeX + half, nodeY + half, viewX, viewY, width, height, setCell);
+    }
+
+    LifeRule rule_;
+    std::deque<HashNode> nodes_;  // stable storage, nodes are never freed
+    std::unordered_map<NodeKey, const HashNode*, NodeKeyHash> table_;
+    std::vector<const HashNode*> emptyNodes_;
+    const HashNode* root_;
+    int64_t originX_;
+    int64_t originY_;
+    uint64_t generation_;
+};
+
+#endif
@@ -0,0 +1,151 @@
+#ifndef INCLUDE_LIFE_RULE_HPP
+#define INCLUDE_LIFE_RULE_HPP
+
+#include <cctype>
+#include <cstdlib>
+#include <string>
+
+// Life-like rule in B/S notation, e.g. B3/S23 for Conway's Game of Life or B36/S23
+// for HighLife, optionally with a number of states for Generations rules (B2/S/C3).
+//
+// born and survive hold one bit per neighbour count: bit n of born is set if a dead
+// cell with n living neighbours comes alive. In Generations rules a living cell that
+// does not survive starts dying and passes through the states 2 .. states - 1 before
+// it is dead again; only state 1 counts as a living neighbour.
+struct LifeRule {
+    LifeRule()
+        : born(1 << 3)
+        , survive((1 << 2) | (1 << 3))
+        , states(2)
+    {
+    }
+
+    // Accepts B3/S23, S23/B3, the older S/B notation 23/3 and Generations rules with a
+    // third part giving the number of states (B2/S/C3, 12/34/3). Case is ignored.
+    static bool parse(const std::string &text, LifeRule &rule)
+    {
+        std::string parts[3];
+        int count = 0;
+
+        for (size_t i = 0; i < text.size(); ++i) {
+            const char c = static_cast<char>(toupper(static_cast<unsigned char>(text[i])));
+            if (c == '/') {
+                if (++count == 3) {
+                    return false;
+                }
+            } else if (!isspace(static_cast<unsigned char>(c))) {
+                parts[count] += c;
+            }
+        }
+        ++count;
+
+        if (count < 2) {
+            return false;
+        }
+
+        LifeRule parsed;
+        parsed.born = 0;
+        parsed.survive = 0;
+
+        const bool isBS = !parts[0].empty() && (parts[0][0] == 'B' || parts[0][0] == 'S');
+        for (int i = 0; i < 2; ++i) {
+            const std::string &part = parts[i];
+            unsigned* mask;
+            size_t start = 0;
+
+            if (isBS) {
+                if (part.empty() || (part[0] != 'B' && part[0] != 'S')) {
+                    return false;
+                }
+                mask = (part[0] == 'B') ? &parsed.born : &parsed.survive;
+                start = 1;
+            } else {
+                // S/B notation lists the survival counts first
+                mask = (i == 0) ? &parsed.survive : &parsed.born;
+            }
+
+            for (size_t j = start; j < part.size(); ++j) {
+                if (part[j] < '0' || part[j] > '8') {
+                    return false;
+                }
+                *mask |= 1u << (part[j] - '0');
+            }
+        }
+
+        if (isBS && parts[0][0] == parts[1][0]) {
+            return false; // B and S given twice
+        }
+
+        if (count == 3) {
+            const std::string &part = parts[2];
+            const size_t start = (!part.empty() && (part[0] == 'C' || part[0] == 'G')) ? 1 : 0;
+            if (start == part.size() || part.find_first_not_of("0123456789", start) != std::string::npos) {
+                return false;
+            }
+            parsed.states = atoi(part.c_str() + start);
+            if (parsed.states < 2 || parsed.states > 256) {
+                return false;
+            }
+        }
+
+        rule = parsed;
+        return true;
+    }
+
+    std::string name() const
+    {
+        std::string text = "B" + digits(born) + "/S" + digits(survive);
+        if (states > 2) {
+            text += "/C" + std::to_string(states);
+        }
+        return text;
+    }
+
+    bool isGenerations() const { return states > 2; }
+
+    // dead cells with no living neighbours come alive, so an infinite plane fills up
+    bool bornWithoutNeighbours() const { return born & 1; }
+
+    bool isBorn(int neighbours) const { return (born >> neighbours) & 1; }
+    bool survives(int neighbours) const { return (survive >> neighbours) & 1; }
+
+    // State of a cell in the next generation
+    int nextState(int state, int neighbours) const
+    {
+        if (state == 0) {
+            return isBorn(neighbours) ? 1 : 0;
+        }
+        if (state == 1 && survives(neighbours)) {
+            return 1;
+        }
+        return (state + 1) % states;
+    }
+
+    bool operator==(const LifeRule &other) const
+    {
+        return born == other.born && survive == other.survive && states == other.states;
+    }
+
+    bool operator!=(const LifeRule &other) const
+    {
+        return !(*this == other);
+    }
+
+    unsigned born;
+    unsigned survive;
+    int states;
+
+private:
+    static std::string digits(unsigned mask)
+    {
+        std::string text;
+        for (int n = 0; n <= 8; ++n) {
+            if ((mask >> n) & 1) {
+                text += static_cast<char>('0' + n);
+            }
+        }
+        return text;
+    }
+};
+
+#endif
@@ -0,0 +1,333 @@
+#ifndef INCLUDE_PATTERN_IO_HPP
+#define INCLUDE_PATTERN_IO_HPP
+
+#include <algorithm>
+#include <cctype>
+#include <climits>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "bitmap_image.hpp"
+#include "frame.hpp"
+
+// Pattern files:
+//  * 24 bit bitmaps, where black pixels are alive
+//  * Life RLE (.rle), the run length encoded text format used by most Life programs
+//  * snapshots (.gol), a header followed by the frame words, used for checkpoints
+
+const char SNAPSHOT_MAGIC[4] = { 'G', 'O', 'L', '1' };
+
+inline bool hasExtension(const std::string &filename, const std::string &extension)
+{
+    return filename.size() >= extension.size()
+        && filename.compare(filename.size() - extension.size(), extension.size(), extension) == 0;
+}
+
+inline bool isBigEndian()
+{
+    const unsigned int v = 0x01;
+    return 1 != reinterpret_cast<const char*>(&v)[0];
+}
+
+inline uint64_t readLittleEndian(const unsigned char* bytes, int count)
+{
+    uint64_t value = 0;
+    for (int i = count - 1; i >= 0; --i) {
+        value = (value << 8) | bytes[i];
+    }
+    return value;
+}
+
+inline void writeLittleEndian(std::ostream &stream, uint64_t value, int count)
+{
+    for (int i = 0; i < count; ++i) {
+        stream.put(static_cast<char>((value >> (8 * i)) & 0xFF));
+    }
+}
+
+inline int countTrailingZeros(uint64_t word)
+{
+#if defined(__GNUC__)
+    return __builtin_ctzll(word);
+#else
+    int count = 0;
+    while (!(word & 1)) {
+        word >>= 1;
+        ++count;
+    }
+    return count;
+#endif
+}
+
+// First column at or after x whose cell has the given state, or width if there is none
+inline int findCell(const uint64_t* row, int x, int width, bool alive)
+{
+    while (x < width) {
+        uint64_t word = alive ? row[x / 64] : ~row[x / 64];
+        word >>= x % 64;
+        if (word) {
+            return std::min(width, x + countTrailingZeros(word));
+        }
+        x = (x / 64 + 1) * 64;
+    }
+    return width;
+}
+
+// Sets count cells starting at column x, clipped to the frame
+inline void setRun(Frame &frame, int x, int y, uint64_t count)
+{
+    if (y < 0 || y >= frame.height || x < 0 || x >= frame.width) {
+        return;
+    }
+
+    const int end = static_cast<int>(std::min<uint64_t>(frame.width, static_cast<uint64_t>(x) + count));
+    uint64_t* row = frame.row(y);
+
+    while (x < end) {
+        const int bits = std::min(64 - x % 64, end - x);
+        const uint64_t mask = (bits == 64) ? ~uint64_t(0) : ((uint64_t(1) << bits) - 1);
+        row[x / 64] |= mask << (x % 64);
+        x += bits;
+    }
+}
+
+inline bool loadBitmap(const std::string &filename, Frame &frame)
+{
+    bitmap_image image(filename, bitmap_image::read_only_mapping);
+
+    if (!image) {
+        std::cerr << "Could not open bitmap!" << std::endl;
+        return false;
+    }
+
+    frame = Frame(filename, image.width(), image.height());
+    // only exactly black pixels are alive
+    image.export_bit_mask(frame.words.data(), frame.wordsPerRow, 1);
+
+    return true;
+}
+
+// Parses the header line "x = <width>, y = <height>[, rule = <rule>]"
+inline bool parseRleHeader(const std::string &line, int &width, int &height, std::string &rule)
+{
+    std::string compact;
+    for (char c : line) {
+        if (!isspace(static_cast<unsigned char>(c))) {
+            compact += c;
+        }
+    }
+
+    const size_t x = compact.find("x=");
+    const size_t y = compact.find("y=");
+    if (x == std::string::npos || y == std::string::npos) {
+        return false;
+    }
+
+    width = atoi(compact.c_str() + x + 2);
+    height = atoi(compact.c_str() + y + 2);
+
+    const size_t r = compact.find("rule=");
+    if (r != std::string::npos) {
+        rule = compact.substr(r + 5);
+    }
+
+    return width > 0 && height > 0;
+}
+
+// Reads a Life RLE file in large chunks, setting whole runs of cells at once. rule is
+// set to the rule given in the header, if any.
+inline bool loadRle(const std::string &filename, Frame &frame, std::string &rule)
+{
+    std::ifstream stream(filename.c_str(), std::ios::binary);
+
+    if (!stream) {
+        std::cerr << "Could not open pattern " << filename << std::endl;
+        return false;
+    }
+
+    std::string line;
+    int width = 0;
+    int height = 0;
+
+    while (std::getline(stream, line)) {
+        if (!line.empty() && line[0] != '#') {
+            break;
+        }
+    }
+
+    if (!parseRleHeader(line, width, height, rule)) {
+        std::cerr << "Invalid RLE header in " << filename << std::endl;
+        return false;
+    }
+
+    frame = Frame(filename, width, height);
+
+    std::vector<char> buffer(1 << 20);
+    int x = 0;
+    int y = 0;
+    uint64_t count = 0;
+
+    while (stream) {
+        stream.read(&buffer[0], buffer.size());
+        const std::streamsize read = stream.gcount();
+
+        for (std::streamsize i = 0; i < read; ++i) {
+            const char c = buffer[i];
+
+            if (c >= '0' && c <= '9') {
+                // runs past the board are clipped anyway, saturate before they overflow
+                count = std::min<uint64_t>(count * 10 + (c - '0'), INT_MAX);
+                continue;
+            }
+            if (isspace(static_cast<unsigned char>(c))) {
+                continue;
+            }
+
+            const uint64_t run = count ? count : 1;
+            count = 0;
+
+            if (c == '!') {
+                return true;
+            } else if (c == '$') {
+                y = static_cast<int>(std::min<uint64_t>(frame.height, static_cast<uint64_t>(y) + run));
+                x = 0;
+            } else if (c == 'b' || c == '.') {
+                x = static_cast<int>(std::min<uint64_t>(frame.width, static_cast<uint64_t>(x) + run));
+            } else {
+                // 'o' and the state letters of multi-state rules are alive
+                setRun(frame, x, y, run);
+                x = static_cast<int>(std::min<uint64_t>(frame.width, static_cast<uint64_t>(x) + run));
+            }
+        }
+    }
+
+    return true;
+}
+
+inline void writeRle(const Frame &frame, std::ostream &stream, const std::string &rule = "B3/S23")
+{
+    stream << "x = " << frame.width << ", y = " << frame.height << ", rule = " << rule << "\n";
+
+    size_t lineLength = 0;
+    auto emit = [&](uint64_t count, char tag) {
+        std::string token = (count > 1) ? std::to_string(count) : std::string();
+        token += tag;
+        // lines of RLE files should not exceed 70 characters
+        if (lineLength + token.size() > 70) {
+            stream << "\n";
+            lineLength = 0;
+        }
+        stream << token;
+        lineLength += token.size();
+    };
+
+    uint64_t pendingRows = 0;
+
+    for (int y = 0; y < frame.height; ++y) {
+        const uint64_t* row = frame.row(y);
+        int x = findCell(row, 0, frame.width, true);
+
+        if (x == frame.width) {
+            ++pendingRows;
+            continue;
+        }
+
+        if (pendingRows > 0) {
+            emit(pendingRows, '$');
+        }
+
+        int dead = x;
+        while (x < frame.width) {
+            const int end = findCell(row, x, frame.width, false);
+            if (dead > 0) {
+                emit(dead, 'b');
+            }
+            emit(end - x, 'o');
+            x = findCell(row, end, frame.width, true);
+            dead = x - end;
+        }
+
+        pendingRows = 1;
+    }
+
+    emit(1, '!');
+    stream << "\n";
+}
+
+// Snapshots store width, height and generation, followed by the frame words, all little endian
+inline bool loadSnapshot(const std::string &filename, Frame &frame)
+{
+    std::ifstream stream(filename.c_str(), std::ios::binary);
+
+    if (!stream) {
+        std::cerr << "Could not open snapshot " << filename << std::endl;
+        return false;
+    }
+
+    unsigned char header[20];
+    stream.read(reinterpret_cast<char*>(header), sizeof(header));
+
+    if (!stream || !std::equal(SNAPSHOT_MAGIC, SNAPSHOT_MAGIC + 4, header)) {
+        std::cerr << "Invalid snapshot " << filename << std::endl;
+        return false;
+    }
+
+    const int width = static_cast<int>(readLittleEndian(header + 4, 4));
+    const int height = static_cast<int>(readLittleEndian(header + 8, 4));
+
+    // the size has to be valid and fit the rest of the file before the frame is allocated
+    const std::streampos start = stream.tellg();
+    stream.seekg(0, std::ios::end);
+    const uint64_t remaining = static_cast<uint64_t>(stream.tellg() - start);
+    stream.seekg(start);
+
+    if (width <= 0 || height <= 0 || width > INT_MAX - 63
+        || (static_cast<uint64_t>(width) + 63) / 64 * height > remaining / sizeof(uint64_t)) {
+        std::cerr << "Invalid snapshot size in " << filename << std::endl;
+        return false;
+    }
+
+    frame = Frame(filename, width, height, readLittleEndian(header + 12, 8));
+
+    stream.read(reinterpret_cast<char*>(frame.words.data()), frame.words.size() * sizeof(uint64_t));
+
+    if (!stream) {
+        std::cerr << "Snapshot " << filename << " is truncated" << std::endl;
+        return false;
+    }
+
+    if (isBigEndian()) {
+        for (uint64_t &word : frame.words) {
+            word = readLittleEndian(reinterpret_cast<const unsigned char*>(&word), 8);
+        }
+    }
+
+    // the engines expect the padding bits behind the last column to be zero
+    const uint64_t lastWordMask = (width % 64) ? (uint64_t(1) << (width % 64)) - 1 : ~uint64_t(0);
+    for (int y = 0; y < height; ++y) {
+        frame.row(y)[frame.wordsPerRow - 1] &= lastWordMask;
+    }
+
+    return true;
+}
+
+inline void writeSnapshot(const Frame &frame, std::ostream &stream)
+{
+    stream.write(SNAPSHOT_MAGIC, 4);
+    writeLittleEndian(stream, frame.width, 4);
+    writeLittleEndian(stream, frame.height, 4);
+    writeLittleEndian(stream, frame.generation, 8);
+
+    if (isBigEndian()) {
+        for (uint64_t word : frame.words) {
+            writeLittleEndian(stream, word, 8);
+        }
+    } else {
+        stream.write(reinterpret_cast<const char*>(frame.words.data()), frame.words.size() * sizeof(uint64_t));
+    }
+}
+
+#endif
@@ -0,0 +1,210 @@
+#ifndef INCLUDE_RASTER_HPP
+#define INCLUDE_RASTER_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+#include "counter_rng.hpp"
+#include "frame.hpp"
+#include "life_rule.hpp"
+#include "thread_pool.hpp"
+
+const unsigned char ALIVE = 1;
+const unsigned char DEAD = 0;
+
+// Holds the current generation in data and the one being computed in back. Stepping
+// writes into back and swaps both, so no memory is allocated per generation.
+struct Raster {
+    Raster(int w, int h) : width(w), height(h), size(w*h)
+    {
+        allocate();
+    }
+
+    explicit Raster(const Frame &frame) : width(frame.width), height(frame.height), size(frame.width*frame.height)
+    {
+        allocate();
+
+        for (int y = 0; y < height; ++y) {
+            for (int x = 0; x < width; ++x) {
+                if (frame.get(x, y)) {
+                    data[index(x,y)] = ALIVE;
+                }
+            }
+        }
+    }
+
+    bool inBounds(const int &x, const int &y) const {
+        if (x < 0 || y < 0 || x > width-1 || y > height-1) {
+            return false;
+        }
+        return true;
+    }
+
+    Raster(const Raster &other) : width(other.width), height(other.height), size(other.size)
+    {
+        allocate();
+        std::copy(other.data, other.data + size, data);
+    }
+
+    Raster(Raster &&other) : width(0), height(0), size(0), data(nullptr), back(nullptr)
+    {
+        swap(other);
+    }
+
+    // copy-and-swap covers both copy and move assignment
+    Raster& operator=(Raster other)
+    {
+        swap(other);
+        return *this;
+    }
+
+    ~Raster()
+    {
+        delete[] data;
+        delete[] back;
+    }
+
+    void swap(Raster &other)
+    {
+        std::swap(width, other.width);
+        std::swap(height, other.height);
+        std::swap(size, other.size);
+        std::swap(data, other.data);
+        std::swap(back, other.back);
+    }
+
+    // makes the freshly computed back buffer the current generation
+    void swapBuffers()
+    {
+        std::swap(data, back);
+    }
+
+    size_t index(int x, int y) const { return x + width * y; }
+    size_t x(int index) const { return index % width; }
+    size_t y(int index) const { return (index - x(index)) / width; }
+
+    int width;
+    int height;
+    int size;
+    int* data;
+    int* back;
+
+private:
+    void allocate()
+    {
+        data = new int[size]();
+        back = new int[size]();
+    }
+};
+
+inline int neighborValue(const Raster &raster, int x, int y, bool isTorus, const LifeRule &rule)
+{
+    int numNeighbours = 0;
+
+    for (int yy = y-1; yy <= y+1; yy++) {
+        for (int xx = x-1; xx <= x+1; xx++) {
+            if (xx == x && yy == y) {
+                continue; // not a neighbour
+            }
+
+            bool inBounds = raster.inBounds(xx,yy);
+
+            if (!isTorus && !inBounds) {
+                continue; // i.e. dead
+            }
+
+            int actualX = xx;
+            int actualY = yy;
+
+            if (!inBounds) {
+                // transform to torus
+                actualX = (xx + raster.width) % raster.width;
+                actualY = (yy + raster.height) % raster.height;
+            }
+
+            const int currentCellState = raster.data[raster.index(actualX, actualY)];
+
+            if (currentCellState == ALIVE) {
+                numNeighbours++;
+            }
+        }
+    }
+
+    const int cellState = raster.data[raster.index(x,y)];
+
+    // apply rules
+    return rule.nextState(cellState, numNeighbours);
+}
+
+inline void invadeRows(Raster &raster, const RandomMask &mask, const CounterRng &rng, uint32_t generation, int begin, int end)
+{
+    const int words = (raster.width + 63) / 64;
+
+    for (int y = begin; y < end; ++y) {
+        for (int w = 0; w < words; ++w) {
+            // same random bits as the bitpacked engine, so both stay identical
+            const uint64_t flips = mask.draw(rng, CounterRng::INVASION, generation, y, w);
+            for (int bit = 0; bit < 64 && w * 64 + bit < raster.width; ++bit) {
+                if ((flips >> bit) & 1) {
+                    int index = raster.index(w * 64 + bit, y);
+                    // flip cell state, dying cells of Generations rules count as dead
+                    raster.data[index] = (raster.data[index] == ALIVE) ? DEAD : ALIVE;
+                }
+            }
+        }
+    }
+}
+
+inline void simulateInvasion(Raster &raster, float invasionFactor, const CounterRng &rng, uint32_t generation,
+                             ThreadPool* pool = nullptr)
+{
+    const RandomMask mask(invasionFactor);
+
+    if (mask.isEmpty())
+    {
+        return;
+    }
+
+    if (pool) {
+        const int band = pool->bandHeight(raster.height, raster.width * sizeof(int));
+        pool->parallelFor(raster.height, band, [&](int begin, int end) {
+            invadeRows(raster, mask, rng, generation, begin, end);
+        });
+    } else {
+        invadeRows(raster, mask, rng, generation, 0, raster.height);
+    }
+}
+
+inline void simulateRows(const Raster &raster, int* data, int begin, int end, bool isTorus, const LifeRule &rule)
+{
+    for (int y = begin; y < end; ++y) {
+        for (int x = 0; x < raster.width; ++x) {
+            int index = raster.index(x,y);
+            data[index] = neighborValue(raster, x, y, isTorus, rule);
+        }
+    }
+}
+
+inline void simulateNextState(Raster &raster, bool isTorus, const LifeRule &rule, ThreadPool* pool = nullptr)
+{
+    const int width = raster.width;
+    const int height = raster.height;
+
+    int* data = raster.back;
+
+    if (pool) {
+        // every band reads the old buffer only, so neighbouring bands need no halo copies
+        const int band = pool->bandHeight(height, width * sizeof(int));
+        pool->parallelFor(height, band, [&](int begin, int end) {
+            simulateRows(raster, data, begin, end, isTorus, rule);
+        });
+    } else {
+        simulateRows(raster, data, 0, height, isTorus, rule);
+    }
+
+    raster.swapBuffers();
+}
+
+#endif
@@ -0,0 +1,152 @@
+#ifndef INCLUDE_THREAD_POOL_HPP
+#define INCLUDE_THREAD_POOL_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads that is reused for every generation, so stepping a
+// board does not pay for thread creation. The calling thread works along.
+class ThreadPool
+{
+public:
+    typedef std::function<void(int, int)> Task;
+
+    explicit ThreadPool(int threads)
+        : task_(nullptr)
+        , count_(0)
+        , grain_(1)
+        , next_(0)
+        , busy_(0)
+        , generation_(0)
+        , stop_(false)
+    {
+        for (int i = 1; i < threads; ++i)
+        {
+            workers_.push_back(std::thread(&ThreadPool::work, this));
+        }
+    }
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        wake_.notify_all();
+
+        for (auto &worker : workers_)
+        {
+            worker.join();
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // number of threads including the calling one
+    int size() const
+    {
+        return static_cast<int>(workers_.size()) + 1;
+    }
+
+    // Rows per band so that a band of the source board stays within a typical L2 cache,
+    // while still leaving a few bands per thread for load balancing.
+    int bandHeight(int rows, size_t bytesPerRow) const
+    {
+        const size_t cacheBytes = 256 * 1024;
+        const int cacheRows = static_cast<int>(std::max<size_t>(1, cacheBytes / std::max<size_t>(1, bytesPerRow)));
+        const int balancedRows = std::max(1, rows / (4 * size()));
+        return std::min(cacheRows, balancedRows);
+    }
+
+    // Calls task(begin, end) for consecutive chunks of [0, count) with at most grain items
+    // each, distributed dynamically over all threads. Returns once every chunk is done.
+    void parallelFor(int count, int grain, const Task &task)
+    {
+        grain = std::max(1, grain);
+
+        if (workers_.empty() || count <= grain)
+        {
+            for (int begin = 0; begin < count; begin += grain)
+            {
+                task(begin, std::min(begin + grain, count));
+            }
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            task_ = &task;
+            count_ = count;
+            grain_ = grain;
+            next_ = 0;
+            busy_ = static_cast<int>(workers_.size());
+            ++generation_;
+        }
+        wake_.notify_all();
+
+        runChunks();
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        done_.wait(lock, [this]() { return busy_ == 0; });
+        task_ = nullptr;
+    }
+
+protected:
+    void work()
+    {
+        unsigned int seenGeneration = 0;
+
+        for (;;)
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            wake_.wait(lock, [&]() { return stop_ || generation_ != seenGeneration; });
+            if (stop_)
+            {
+                return;
+            }
+            seenGeneration = generation_;
+            lock.unlock();
+
+            runChunks();
+
+            lock.lock();
+            if (--busy_ == 0)
+            {
+                done_.notify_one();
+            }
+        }
+    }
+
+    void runChunks()
+    {
+        for (;;)
+        {
+            const int begin = next_.fetch_add(grain_);
+            if (begin >= count_)
+            {
+                return;
+            }
+            (*task_)(begin, std::min(begin + grain_, count_));
+        }
+    }
+
+    std::vector<std::thread> workers_;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable done_;
+    const Task* task_;
+    int count_;
+    int grain_;
+    std::atomic<int> next_;
+    int busy_;
+    unsigned int generation_;
+    bool stop_;
+};
+
+#endif
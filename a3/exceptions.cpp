@@ -5,7 +5,9 @@
 #include <iomanip>
 #include <vector>
 #include <stdexcept>
+#include <algorithm>
 #include <assert.h>
+#include "csv_tokenizer.hpp"
 
 using namespace std;
 
@@ -32,46 +34,38 @@ tm stringToTime(string date) throw(logic_error)
     return t;
 }
 
-void tokenize(const string str, vector<string> &tokens, const char delimiter)
+// splits the line at the delimiter of the file, consecutive delimiters make no empty tokens
+void tokenize(const CsvReader &file, const StringRef &line, vector<StringRef> &tokens)
 {
-    size_t start = str.find_first_not_of(delimiter);
-    size_t end = start;
-
-    while (start != string::npos) {
-        end = str.find(delimiter, start);
-        tokens.push_back(str.substr(start, end - start));
-        start = str.find_first_not_of(delimiter, end);
-    }
+    file.split(line, tokens);
+    tokens.erase(remove_if(tokens.begin(), tokens.end(), [](const StringRef &token) { return token.empty(); }),
+                 tokens.end());
 }
 
-void parseLine(string line, int lineNum) throw(FormatException)
+void parseLine(const CsvReader &file, const StringRef &line, int lineNum, vector<StringRef> &fieldValues) throw(FormatException)
 {
     if (lineNum <= 0) {
         return;
     }
 
     const string fieldNames[3] = {"Date", "Temperature", "Rainfall"};
-    vector<string> fieldValues;
     FormatException formatException(lineNum);
+    float value;
 
-    tokenize(line, fieldValues, FIELD_DELIMITER);
+    tokenize(file, line, fieldValues);
     assert(fieldValues.size() == 3);
 
     try {
-        stringToTime(fieldValues[0]);
+        stringToTime(fieldValues[0].str());
     } catch (logic_error e) {
         formatException.m_actFields += fieldNames[0] + " ";
     }
 
-    try {
-        stof(fieldValues[1]);
-    } catch (...) {
+    if (!parseFloat(fieldValues[1], value)) {
         formatException.m_actFields += fieldNames[1] + " ";
     }
 
-    try {
-        stof(fieldValues[2]);
-    } catch (...) {
+    if (!parseFloat(fieldValues[2], value)) {
         formatException.m_actFields += fieldNames[2] + " ";
     }
 
@@ -121,22 +115,21 @@ void checkData(string path)
 	int validLines = 0;
     int invalidLines = 0;
     int lineNumber = 0;
-    ifstream file;
+    CsvReader file(path.c_str(), FIELD_DELIMITER);
 
-    try {
-        file.open(path);
-        string line;
-        while (getline(file, line)) {
+    if (file.isOpen()) {
+        StringRef line;
+        vector<StringRef> fieldValues; // reused for every line, the values point into the read buffer
+        while (file.nextLine(line)) {
             try {
-                parseLine(line, ++lineNumber);
+                parseLine(file, line, ++lineNumber, fieldValues);
                 ++validLines;
             } catch (FormatException e) {
                 writeOutFormatException(e);
                 ++invalidLines;
             }
         }
-        file.close();
-    } catch (ifstream::failure e) {
+    } else {
         cerr << "Exception opening/reading/closing file" << endl;
     }
     cout << "valid lines: " << validLines << " - invalid lines: " << invalidLines << endl;
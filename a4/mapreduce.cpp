@@ -10,6 +10,7 @@
 #include <vector>
 #include <algorithm>
 #include <numeric>
+#include "csv_tokenizer.hpp"
 
 // Calculates the distance between two points on earth specified by longitude/latitude. 
 // Function taken and adapted from http://www.codeproject.com/Articles/22488/Distance-using-Longitiude-and-latitude-using-c 
@@ -48,61 +49,44 @@ struct AirportInfo
 void importAirportData(char* path, std::map<int, AirportInfo>& airportInfo)
 {
 	std::cout << "Importing airport data.." << std::endl;
-	std::ifstream file(path);
-	std::string field, line;
-	
-	int currentLineNum = 0;
+	CsvReader file(path, ';', true);
+	std::vector<StringRef> fields;
 
-	while (std::getline(file, line)) 
+	while (file.nextRow(fields))
 	{
-		std::istringstream linestream;
-		linestream.str(line);
-		int fieldNum = 0;
 		int currentID = -1;
-		std::string result;
-		currentLineNum++;
-		
-		while (std::getline(linestream, field, ';'))
+
+		// fields that do not convert are skipped
+		for (size_t fieldNum = 0; fieldNum < fields.size(); fieldNum++)
 		{
-			try
+			const StringRef& field = fields[fieldNum];
+
+			switch (fieldNum)
 			{
-				switch (fieldNum)
+			case 0: // id
+				if (parseInt(field, currentID))
 				{
-				case 0: // id
-					currentID = std::stoi(field);
 					airportInfo.insert(std::make_pair(currentID, AirportInfo()));
-					break;
-				case 1: // name
-					airportInfo[currentID].m_name = field;
-					break;
-				case 2: // city
-					airportInfo[currentID].m_city = field;
-					break;
-				case 3: // country
-					airportInfo[currentID].m_country = field;
-					break;
-				case 6: //latitude
-					airportInfo[currentID].pos[0] = std::stof(field);
-					break;
-				case 7: // longitude
-					airportInfo[currentID].pos[1] = std::stof(field);
-					break;
-				default:
-					break;
 				}
+				break;
+			case 1: // name
+				airportInfo[currentID].m_name = field.str();
+				break;
+			case 2: // city
+				airportInfo[currentID].m_city = field.str();
+				break;
+			case 3: // country
+				airportInfo[currentID].m_country = field.str();
+				break;
+			case 6: //latitude
+				parseFloat(field, airportInfo[currentID].pos[0]);
+				break;
+			case 7: // longitude
+				parseFloat(field, airportInfo[currentID].pos[1]);
+				break;
+			default:
+				break;
 			}
-			catch (const std::invalid_argument&)
-			{
-				//std::cout << "Couldn't convert field " << currentLineNum << " correctly (invalid argument)!" << std::endl;
-				//std::cout << field << std::endl;
-			}
-			catch (const std::out_of_range&)
-			{
-				//std::cout << "Couldn't convert field " << currentLineNum << " correctly (out of range)!" << std::endl;
-				//std::cout << field << std::endl;
-			}
-
-			fieldNum++;
 		}
 	}
 }
@@ -110,53 +94,32 @@ void importAirportData(char* path, std::map<int, AirportInfo>& airportInfo)
 void importRoutesData(char* path, std::map<int, AirportInfo>& airportInfo)
 {
 	std::cout << "Importing routes data.." << std::endl;
-	std::ifstream file(path);
-	std::string field, line;
-
-	int currentLineNum = 0;
+	CsvReader file(path, ';');
+	std::vector<StringRef> fields;
 
-	while (std::getline(file, line))
+	while (file.nextRow(fields))
 	{
-		std::istringstream linestream;
-		linestream.str(line);
-		int fieldNum = 0;
 		int sourceID = -1;
 		int destID = -1;
 		int stops = -1;
-		std::string result;
-		currentLineNum++;
 
-		while (std::getline(linestream, field, ';'))
+		// fields that do not convert are skipped
+		for (size_t fieldNum = 0; fieldNum < fields.size(); fieldNum++)
 		{
-			try
-			{
-				switch (fieldNum)
-				{
-				case 3: // source id
-					sourceID = std::stoi(field);
-					break;
-				case 5: // dest id
-					destID = std::stoi(field);
-					break;
-				case 7: // stops
-					stops = std::stoi(field);
-					break;
-				default:
-					break;
-				}
-			}
-			catch (const std::invalid_argument&)
+			switch (fieldNum)
 			{
-				//std::cout << "Couldn't convert field " << currentLineNum << " correctly (invalid argument)!" << std::endl;
-				//std::cout << field << std::endl;
+			case 3: // source id
+				parseInt(fields[fieldNum], sourceID);
+				break;
+			case 5: // dest id
+				parseInt(fields[fieldNum], destID);
+				break;
+			case 7: // stops
+				parseInt(fields[fieldNum], stops);
+				break;
+			default:
+				break;
 			}
-			catch (const std::out_of_range&)
-			{
-				//std::cout << "Couldn't convert field " << currentLineNum << " correctly (out of range)!" << std::endl;
-				//std::cout << field << std::endl;
-			}
-
-			fieldNum++;
 		}
 		if (sourceID != -1 && destID != -1 && stops != -1)
 		{
@@ -8,6 +8,7 @@
 #include <string>
 #include <cassert>
 #include <algorithm>
+#include "csv_tokenizer.hpp"
 
 const int NUMBER_TABLES = 10; // max number of tables in the restaurant
 const int AVG_SEATS_PER_TABLE = 6; // average number of seats per table
@@ -42,55 +43,26 @@ std::vector<Order> takeOrders(char* path)
 {
 	std::vector<Order> orders;
     
-    std::ifstream file(path);
-    std::string field, line;
+    CsvReader file(path, ';');
+    std::vector<StringRef> fields;
     
     int currentLineNum = 0;
     
     Order order;
+    int* const entries[] = { &order.table, &order.coffee, &order.coke, &order.burger, &order.salad };
     
-    while (std::getline(file, line))
+    while (file.nextRow(fields))
     {
-        std::istringstream linestream;
-        linestream.str(line);
-        int fieldNum = 0;
         currentLineNum++;
         
-        while (std::getline(linestream, field, ';'))
+        for (size_t fieldNum = 0; fieldNum < fields.size() && fieldNum < 5; fieldNum++)
         {
-            try
+            if (!parseInt(fields[fieldNum], *entries[fieldNum]))
             {
-                switch (fieldNum)
-                {
-                    case 0:
-                        order.table = std::stoi(field);
-                        break;
-                    case 1:
-                        order.coffee = std::stoi(field);
-                        break;
-                    case 2:
-                        order.coke = std::stoi(field);
-                        break;
-                    case 3:
-                        order.burger = std::stoi(field);
-                        break;
-                    case 4:
-                        order.salad = std::stoi(field);
-                        break;
-                }
+                std::cout << "Couldn't convert entry " << currentLineNum << " correctly ("
+                          << (errno == ERANGE ? "out of range" : "invalid argument") << ")!" << std::endl;
+                std::cout << fields[fieldNum] << std::endl;
             }
-            catch (const std::invalid_argument&)
-            {
-                std::cout << "Couldn't convert entry " << currentLineNum << " correctly (invalid argument)!" << std::endl;
-                std::cout << field << std::endl;
-            }
-            catch (const std::out_of_range&)
-            {
-                std::cout << "Couldn't convert entry " << currentLineNum << " correctly (out of range)!" << std::endl;
-                std::cout << field << std::endl;
-            }
-            
-            fieldNum++;
         }
         order.id = ++orderSerialNumber;
         orders.push_back(order);
@@ -9,6 +9,7 @@
 #include <numeric>
 #include <chrono>
 #include <assert.h>
+#include "csv_tokenizer.hpp"
 
 struct Route
 {
@@ -30,49 +31,32 @@ bool operator<(const Route& r1, const Route& r2) {
 void importRoutesData(char* path, std::vector<Route>& routes)
 {
 	std::cout << "Importing routes data.." << std::endl;
-	std::ifstream file(path);
-	std::string field, line;
+	CsvReader file(path, ';');
+	std::vector<StringRef> fields;
 	
-	while (std::getline(file, line))
+	while (file.nextRow(fields))
 	{
-		std::istringstream linestream;
-		linestream.str(line);
-		int fieldNum = 0;
 		Route route;
 		route.airlineId = route.sourceId = route.destinationId = -1;
 
-		while (std::getline(linestream, field, ';'))
+		// fields that do not convert leave the route incomplete
+		for (size_t fieldNum = 0; fieldNum < fields.size(); fieldNum++)
 		{
-			std::cout << field;
-			try
+			std::cout << fields[fieldNum];
+			switch (fieldNum)
 			{
-				switch (fieldNum)
-				{
-					case 1: // airline id
-						route.airlineId = std::stoi(field);
-						break;
-					case 3: // source id
-						route.sourceId = std::stoi(field);
-						break;
-					case 5: // dest id
-						route.destinationId = std::stoi(field);
-						break;
-					default:
-						break;
-				}
+				case 1: // airline id
+					parseInt(fields[fieldNum], route.airlineId);
+					break;
+				case 3: // source id
+					parseInt(fields[fieldNum], route.sourceId);
+					break;
+				case 5: // dest id
+					parseInt(fields[fieldNum], route.destinationId);
+					break;
+				default:
+					break;
 			}
-			catch (const std::invalid_argument&)
-			{
-				//std::cout << "Couldn't convert field correctly (invalid argument)!" << std::endl;
-				//std::cout << field << std::endl;
-			}
-			catch (const std::out_of_range&)
-			{
-				//std::cout << "Couldn't convert field correctly (out of range)!" << std::endl;
-				//std::cout << field << std::endl;
-			}
-
-			fieldNum++;
 		}
 
 		if (route.airlineId > -1 && route.sourceId > -1 && route.destinationId > -1)
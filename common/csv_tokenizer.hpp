@@ -0,0 +1,269 @@
+#ifndef INCLUDE_CSV_TOKENIZER_HPP
+#define INCLUDE_CSV_TOKENIZER_HPP
+
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define CSV_TOKENIZER_SSE2
+#endif
+
+#if defined _MSC_VER
+#include <intrin.h>
+#endif
+
+// Characters of a field within the buffer of a CsvReader, like the std::string_view of
+// C++17. It stays valid until the reader reads the next row.
+class StringRef
+{
+public:
+    StringRef() : data_(nullptr), size_(0) {}
+    StringRef(const char* data, size_t size) : data_(data), size_(size) {}
+
+    const char* data() const { return data_; }
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    const char* begin() const { return data_; }
+    const char* end() const { return data_ + size_; }
+
+    std::string str() const { return std::string(data_, size_); }
+
+    // the field without the quotes around it, if there are any
+    StringRef unquoted() const
+    {
+        if (size_ >= 2 && data_[0] == '"' && data_[size_ - 1] == '"')
+        {
+            return StringRef(data_ + 1, size_ - 2);
+        }
+        return *this;
+    }
+
+private:
+    const char* data_;
+    size_t size_;
+};
+
+inline std::ostream& operator<<(std::ostream &out, const StringRef &text)
+{
+    return out.write(text.data(), text.size());
+}
+
+// Parse the leading number of the field like std::stoi and std::stof. Instead of throwing
+// they return false and set errno to EINVAL if there is no number, or to ERANGE if it is
+// out of range. The reader keeps every field followed by a character that ends the
+// number, so no copy is needed.
+inline bool parseInt(const StringRef &field, int &value)
+{
+    char* end = nullptr;
+    errno = 0;
+    const long result = field.empty() ? 0 : strtol(field.data(), &end, 10);
+
+    if (field.empty() || end == field.data() || end > field.end())
+    {
+        errno = EINVAL;
+        return false;
+    }
+    if (errno == ERANGE || result < INT_MIN || result > INT_MAX)
+    {
+        errno = ERANGE;
+        return false;
+    }
+    value = static_cast<int>(result);
+    return true;
+}
+
+inline bool parseFloat(const StringRef &field, float &value)
+{
+    char* end = nullptr;
+    errno = 0;
+    const float result = field.empty() ? 0.0f : strtof(field.data(), &end);
+
+    if (field.empty() || end == field.data() || end > field.end())
+    {
+        errno = EINVAL;
+        return false;
+    }
+    if (errno == ERANGE)
+    {
+        return false;
+    }
+    value = result;
+    return true;
+}
+
+// Reads a delimited text file row by row into fields that point into one large read
+// buffer, so no string is allocated per line or field. Rows end at '\n' like with
+// std::getline. With quotes, delimiters between double quotes do not split a field;
+// the fields keep their quotes then, see StringRef::unquoted.
+class CsvReader
+{
+public:
+    CsvReader(const char* path, char delimiter, bool quotes = false, size_t bufferSize = 1 << 20)
+        : file_(fopen(path, "rb"))
+        , delimiter_(delimiter)
+        , quotes_(quotes)
+        , buffer_(bufferSize + 1)
+        , begin_(0)
+        , end_(0)
+        , eof_(file_ == nullptr)
+    {
+        buffer_[0] = '\0';
+    }
+
+    ~CsvReader()
+    {
+        if (file_)
+        {
+            fclose(file_);
+        }
+    }
+
+    CsvReader(const CsvReader&) = delete;
+    CsvReader& operator=(const CsvReader&) = delete;
+
+    bool isOpen() const
+    {
+        return file_ != nullptr;
+    }
+
+    // The next row without its line break, false at the end of the file
+    bool nextLine(StringRef &line)
+    {
+        for (;;)
+        {
+            const char* first = &buffer_[begin_];
+            const char* newline = static_cast<const char*>(memchr(first, '\n', end_ - begin_));
+
+            if (newline)
+            {
+                line = StringRef(first, newline - first);
+                begin_ = newline - &buffer_[0] + 1;
+                return true;
+            }
+            if (eof_)
+            {
+                // like std::getline, the last line needs no line break
+                line = StringRef(first, end_ - begin_);
+                begin_ = end_;
+                return !line.empty();
+            }
+            refill();
+        }
+    }
+
+    // The fields of the next row, false at the end of the file
+    bool nextRow(std::vector<StringRef> &fields)
+    {
+        StringRef line;
+        if (!nextLine(line))
+        {
+            return false;
+        }
+        split(line, fields);
+        return true;
+    }
+
+    // Splits the line at the delimiter, an empty line has one empty field
+    void split(const StringRef &line, std::vector<StringRef> &fields) const
+    {
+        fields.clear();
+
+        const char* field = line.begin();
+        const char* end = line.end();
+        const char* position = field;
+        bool quoted = false;
+
+        for (;;)
+        {
+            position = quotes_ ? find(position, end, quoted ? '"' : delimiter_, '"')
+                               : find(position, end, delimiter_, delimiter_);
+
+            if (position == end)
+            {
+                break;
+            }
+            if (*position == '"' && quotes_)
+            {
+                quoted = !quoted; // "" within quotes toggles twice
+                ++position;
+                continue;
+            }
+            fields.push_back(StringRef(field, position - field));
+            field = ++position;
+        }
+        fields.push_back(StringRef(field, end - field));
+    }
+
+private:
+    // first of the two characters in [begin, end) or end, 16 bytes at a time
+    static const char* find(const char* begin, const char* end, char a, char b)
+    {
+#if defined CSV_TOKENIZER_SSE2
+        const __m128i first = _mm_set1_epi8(a);
+        const __m128i second = _mm_set1_epi8(b);
+
+        for (; begin + 16 <= end; begin += 16)
+        {
+            const __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin));
+            const int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(chunk, first), _mm_cmpeq_epi8(chunk, second)));
+            if (mask)
+            {
+#if defined _MSC_VER
+                unsigned long bit;
+                _BitScanForward(&bit, mask);
+                return begin + bit;
+#else
+                return begin + __builtin_ctz(mask);
+#endif
+            }
+        }
+#endif
+        for (; begin < end; ++begin)
+        {
+            if (*begin == a || *begin == b)
+            {
+                return begin;
+            }
+        }
+        return end;
+    }
+
+    // Moves the unfinished row to the front and fills the rest of the buffer, a row
+    // longer than the buffer doubles it
+    void refill()
+    {
+        const size_t pending = end_ - begin_;
+        memmove(&buffer_[0], &buffer_[begin_], pending);
+        begin_ = 0;
+        end_ = pending;
+
+        if (end_ + 1 == buffer_.size())
+        {
+            buffer_.resize(2 * buffer_.size());
+        }
+
+        const size_t read = fread(&buffer_[end_], 1, buffer_.size() - 1 - end_, file_);
+        end_ += read;
+        eof_ = read == 0;
+
+        // the numbers of the last field stop here
+        buffer_[end_] = '\0';
+    }
+
+    FILE* file_;
+    char delimiter_;
+    bool quotes_;
+    std::vector<char> buffer_;
+    size_t begin_;
+    size_t end_;
+    bool eof_;
+};
+
+#endif